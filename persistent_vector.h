@@ -0,0 +1,667 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <utility>
+
+/**
+ * Vector on a relaxed radix balanced (RRB) tree of nodes with up to 32
+ * slots, shared between copies. Copies are O(1). set, push_back and
+ * pop_back copy one root-to-leaf path, or work in place on nodes this copy
+ * owns alone, in O(log32 N). concat and slice build O(log N) new nodes and
+ * share the rest. Nodes where trees were cut or joined keep size tables
+ * ("relaxed"); the others are indexed by radix.
+ */
+template <typename T>
+class persistent_vector {
+  static constexpr unsigned BITS = 5;
+  static constexpr unsigned WIDTH = 1u << BITS;
+  /** Slots concatenation may leave above the minimum at one level: this
+   * bounds the extra steps of a lookup in a relaxed node.
+   */
+  static constexpr unsigned EXTRA = 2;
+
+  struct node {
+    std::atomic<size_t> owners;
+    unsigned count;
+    bool leaf;
+
+    explicit node(bool leaf) : owners(1), count(0), leaf(leaf) {}
+  };
+
+  struct leaf_node : node {
+    alignas(T) unsigned char storage[WIDTH * sizeof(T)];
+
+    leaf_node() : node(true) {}
+    ~leaf_node() { std::destroy_n(data(), this->count); }
+
+    T* data() noexcept { return std::launder(reinterpret_cast<T*>(storage)); }
+  };
+
+  /** sizes[i] is the number of elements under children[0, i]. A node is
+   * relaxed unless all children but the last hold 1 << shift elements.
+   */
+  struct inner_node : node {
+    bool relaxed;
+    size_t sizes[WIDTH];
+    node* children[WIDTH];
+
+    inner_node() : node(false), relaxed(false) {}
+    ~inner_node() {
+      for (unsigned i = 0; i != this->count; ++i) release(children[i]);
+    }
+  };
+
+  static leaf_node* as_leaf(node* n) noexcept {
+    return static_cast<leaf_node*>(n);
+  }
+  static inner_node* as_inner(node* n) noexcept {
+    return static_cast<inner_node*>(n);
+  }
+  static void acquire(node* n) noexcept {
+    n->owners.fetch_add(1, std::memory_order_relaxed);
+  }
+  static void release(node* n) noexcept {
+    if (n->owners.fetch_sub(1, std::memory_order_release) == 1) {
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (n->leaf) {
+        delete as_leaf(n);
+      } else {
+        delete as_inner(n);
+      }
+    }
+  }
+  static size_t size_of(node* n) noexcept {
+    return n->leaf ? n->count : as_inner(n)->sizes[n->count - 1];
+  }
+
+  /** Owning reference, so that half-built nodes are freed on throw. */
+  class ref {
+   public:
+    ref() noexcept : p_(nullptr) {}
+    explicit ref(node* p) noexcept : p_(p) {}
+    ref(ref&& other) noexcept : p_(other.take()) {}
+    ref& operator=(ref&& other) noexcept {
+      std::swap(p_, other.p_);
+      return *this;
+    }
+    ~ref() {
+      if (p_) release(p_);
+    }
+
+    node* get() const noexcept { return p_; }
+    node* take() noexcept { return std::exchange(p_, nullptr); }
+
+   private:
+    node* p_;
+  };
+
+  /** Up to two full levels' worth of owned nodes, for concatenation. */
+  struct node_list {
+    node* items[2 * WIDTH];
+    unsigned count = 0;
+
+    node_list() = default;
+    node_list(node_list const&) = delete;
+    node_list& operator=(node_list const&) = delete;
+    ~node_list() {
+      for (unsigned i = 0; i != count; ++i)
+        if (items[i]) release(items[i]);
+    }
+
+    void add(node* owned) noexcept { items[count++] = owned; }
+    void add_shared(node* n) noexcept {
+      acquire(n);
+      add(n);
+    }
+  };
+
+  /** Appends an owned child to n, a node at the given shift. */
+  static void push_child(inner_node* n, node* child, unsigned shift) noexcept {
+    unsigned i = n->count;
+    if (i != 0 && !n->relaxed)
+      n->relaxed = size_of(n->children[i - 1]) != size_t(1) << shift;
+    n->children[i] = child;
+    n->sizes[i] = (i ? n->sizes[i - 1] : 0) + size_of(child);
+    n->count = i + 1;
+  }
+  /** Picks the child of n holding element i and makes i relative to it. */
+  static unsigned slot_of(inner_node* n, unsigned shift, size_t& i) noexcept {
+    unsigned slot = i >> shift;
+    if (n->relaxed) {
+      while (n->sizes[slot] <= i) ++slot;
+    }
+    if (slot != 0) i -= n->sizes[slot - 1];
+    return slot;
+  }
+
+  static node* clone(node* n) {
+    if (n->leaf) {
+      ref r(new leaf_node());
+      leaf_node* l = as_leaf(r.get());
+      for (; l->count != n->count; ++l->count)
+        new (l->data() + l->count) T(as_leaf(n)->data()[l->count]);
+      return r.take();
+    }
+    inner_node* src = as_inner(n);
+    inner_node* c = new inner_node();
+    c->relaxed = src->relaxed;
+    for (; c->count != src->count; ++c->count) {
+      c->children[c->count] = src->children[c->count];
+      c->sizes[c->count] = src->sizes[c->count];
+      acquire(c->children[c->count]);
+    }
+    return c;
+  }
+  /** Makes *slot safe to change in place: it is cloned unless the tree
+   * owns it alone. Call top-down, starting at root_.
+   */
+  static node* own(node*& slot) {
+    node* n = slot;
+    if (n->owners.load(std::memory_order_acquire) == 1) return n;
+    slot = clone(n);
+    release(n);
+    return slot;
+  }
+  /** Wraps n in single-child inner nodes up to the given shift. */
+  static node* new_path(unsigned shift, node* n) {
+    ref r(n);
+    for (unsigned s = BITS; s <= shift; s += BITS) {
+      inner_node* parent = new inner_node();
+      push_child(parent, r.take(), s);
+      r = ref(parent);
+    }
+    return r.take();
+  }
+
+  /** Pops the last element under n; true if n is then empty. */
+  static bool pop(node* n, unsigned shift) noexcept {
+    if (n->leaf) {
+      as_leaf(n)->data()[--n->count].~T();
+      return n->count == 0;
+    }
+    inner_node* in = as_inner(n);
+    unsigned last = in->count - 1;
+    if (pop(in->children[last], shift - BITS)) {
+      release(in->children[last]);
+      in->count = last;
+      in->relaxed = false;
+      for (unsigned i = 0; i + 1 < last; ++i)
+        in->relaxed |= size_of(in->children[i]) != size_t(1) << shift;
+    } else {
+      --in->sizes[last];
+    }
+    return in->count == 0;
+  }
+
+  /** First k elements under n, 0 < k. */
+  static node* take(node* n, unsigned shift, size_t k) {
+    if (k == size_of(n)) {
+      acquire(n);
+      return n;
+    }
+    if (n->leaf) {
+      ref r(new leaf_node());
+      leaf_node* l = as_leaf(r.get());
+      for (; l->count != k; ++l->count)
+        new (l->data() + l->count) T(as_leaf(n)->data()[l->count]);
+      return r.take();
+    }
+    inner_node* in = as_inner(n);
+    size_t i = k - 1;
+    unsigned slot = slot_of(in, shift, i);
+    ref child(take(in->children[slot], shift - BITS, i + 1));
+    inner_node* c = new inner_node();
+    for (unsigned j = 0; j != slot; ++j) {
+      acquire(in->children[j]);
+      push_child(c, in->children[j], shift);
+    }
+    push_child(c, child.take(), shift);
+    return c;
+  }
+  /** Elements under n after the first k, k < size_of(n). */
+  static node* drop(node* n, unsigned shift, size_t k) {
+    if (k == 0) {
+      acquire(n);
+      return n;
+    }
+    if (n->leaf) {
+      ref r(new leaf_node());
+      leaf_node* l = as_leaf(r.get());
+      for (; k + l->count != n->count; ++l->count)
+        new (l->data() + l->count) T(as_leaf(n)->data()[k + l->count]);
+      return r.take();
+    }
+    inner_node* in = as_inner(n);
+    size_t i = k;
+    unsigned slot = slot_of(in, shift, i);
+    ref child(drop(in->children[slot], shift - BITS, i));
+    inner_node* c = new inner_node();
+    push_child(c, child.take(), shift);
+    for (unsigned j = slot + 1; j != in->count; ++j) {
+      acquire(in->children[j]);
+      push_child(c, in->children[j], shift);
+    }
+    return c;
+  }
+
+  /** Appends to out the concatenation of l and r as nodes at the larger
+   * of their shifts: one or two, or the two leaves themselves.
+   */
+  static void merge(node* l, unsigned ls, node* r, unsigned rs,
+                    node_list& out) {
+    if (ls == 0 && rs == 0) {
+      out.add_shared(l);
+      out.add_shared(r);
+      return;
+    }
+    node_list all;
+    unsigned shift = std::max(ls, rs);
+    if (ls >= rs) {
+      inner_node* li = as_inner(l);
+      for (unsigned i = 0; i + 1 < li->count; ++i)
+        all.add_shared(li->children[i]);
+    }
+    node* lseam = ls >= rs ? as_inner(l)->children[l->count - 1] : l;
+    node* rseam = rs >= ls ? as_inner(r)->children[0] : r;
+    merge(lseam, ls >= rs ? ls - BITS : ls, rseam, rs >= ls ? rs - BITS : rs,
+          all);
+    if (rs >= ls) {
+      inner_node* ri = as_inner(r);
+      for (unsigned i = 1; i < ri->count; ++i) all.add_shared(ri->children[i]);
+    }
+    rebalance(all, shift - BITS, out);
+  }
+  /** Redistributes the slots of nodes at cshift so that there are at most
+   * EXTRA more nodes than needed, then groups them under one or two new
+   * nodes appended to out.
+   */
+  static void rebalance(node_list& all, unsigned cshift, node_list& out) {
+    unsigned plan[2 * WIDTH];
+    unsigned total = 0;
+    for (unsigned i = 0; i != all.count; ++i) {
+      plan[i] = all.items[i]->count;
+      total += plan[i];
+    }
+    unsigned optimal = (total + WIDTH - 1) / WIDTH;
+    unsigned len = all.count;
+    unsigned i = 0;
+    while (len > optimal + EXTRA) {
+      while (plan[i] == WIDTH) ++i;
+      // Spread node i over the ones after it.
+      unsigned rest = plan[i];
+      do {
+        unsigned merged = std::min(rest + plan[i + 1], WIDTH);
+        rest = rest + plan[i + 1] - merged;
+        plan[i] = merged;
+        ++i;
+      } while (rest != 0);
+      std::copy(plan + i + 1, plan + len, plan + i);
+      --len;
+      --i;
+    }
+
+    node_list fresh;
+    unsigned src = 0;
+    unsigned offset = 0;
+    for (unsigned j = 0; j != len; ++j) {
+      node* from = all.items[src];
+      if (offset == 0 && from->count == plan[j]) {
+        fresh.add(std::exchange(all.items[src++], nullptr));
+        continue;
+      }
+      ref r(cshift == 0 ? static_cast<node*>(new leaf_node())
+                        : new inner_node());
+      node* n = r.get();
+      while (n->count != plan[j]) {
+        from = all.items[src];
+        unsigned k = std::min(plan[j] - n->count, from->count - offset);
+        if (cshift == 0) {
+          T* dst = as_leaf(n)->data();
+          T* s = as_leaf(from)->data() + offset;
+          for (unsigned e = 0; e != k; ++e, ++n->count)
+            new (dst + n->count) T(s[e]);
+        } else {
+          for (unsigned e = 0; e != k; ++e) {
+            node* child = as_inner(from)->children[offset + e];
+            acquire(child);
+            push_child(as_inner(n), child, cshift);
+          }
+        }
+        offset += k;
+        if (offset == from->count) {
+          ++src;
+          offset = 0;
+        }
+      }
+      fresh.add(r.take());
+    }
+
+    for (unsigned first = 0; first < fresh.count; first += WIDTH) {
+      ref r(new inner_node());
+      for (unsigned j = first; j != std::min(first + WIDTH, fresh.count); ++j)
+        push_child(as_inner(r.get()), std::exchange(fresh.items[j], nullptr),
+                   cshift + BITS);
+      out.add(r.take());
+    }
+  }
+
+  /** Leaf holding element i; i becomes its index there. */
+  leaf_node* locate(size_t& i) const noexcept {
+    node* n = root_;
+    for (unsigned shift = shift_; shift != 0; shift -= BITS) {
+      inner_node* in = as_inner(n);
+      n = in->children[slot_of(in, shift, i)];
+    }
+    return as_leaf(n);
+  }
+
+  /** Drops single-child roots. */
+  void collapse() noexcept {
+    while (shift_ != 0 && root_->count == 1) {
+      node* child = as_inner(root_)->children[0];
+      acquire(child);
+      release(root_);
+      root_ = child;
+      shift_ -= BITS;
+    }
+  }
+  persistent_vector(node* root, unsigned shift) noexcept
+      : root_(root), size_(root ? size_of(root) : 0), shift_(root ? shift : 0) {
+    if (root_) collapse();
+  }
+
+  /** Invariant: root_ is null iff size_ == 0; leaves sit at shift 0. */
+  node* root_;
+  size_t size_;
+  unsigned shift_;
+
+ public:
+  typedef T value_type;
+  typedef T const& const_reference;
+
+  /** Caches the leaf it points into, so that a scan descends once per
+   * leaf rather than once per element.
+   */
+  class const_iterator {
+   public:
+    using difference_type = std::ptrdiff_t;
+    using value_type = T;
+    using pointer = T const*;
+    using reference = T const&;
+    using iterator_category = std::random_access_iterator_tag;
+
+    const_iterator() noexcept
+        : v_(nullptr), index_(0), leaf_(nullptr), first_(0), last_(0) {}
+
+    reference operator*() const noexcept {
+      if (index_ < first_ || index_ >= last_) {
+        size_t i = index_;
+        leaf_node* l = v_->locate(i);
+        leaf_ = l->data();
+        first_ = index_ - i;
+        last_ = first_ + l->count;
+      }
+      return leaf_[index_ - first_];
+    }
+    pointer operator->() const noexcept { return &**this; }
+    reference operator[](difference_type n) const noexcept {
+      return *(*this + n);
+    }
+
+    const_iterator& operator++() noexcept {
+      ++index_;
+      return *this;
+    }
+    const_iterator operator++(int) noexcept {
+      const_iterator old = *this;
+      ++index_;
+      return old;
+    }
+    const_iterator& operator--() noexcept {
+      --index_;
+      return *this;
+    }
+    const_iterator operator--(int) noexcept {
+      const_iterator old = *this;
+      --index_;
+      return old;
+    }
+    const_iterator& operator+=(difference_type n) noexcept {
+      index_ += n;
+      return *this;
+    }
+    const_iterator& operator-=(difference_type n) noexcept {
+      index_ -= n;
+      return *this;
+    }
+    friend const_iterator operator+(const_iterator it,
+                                    difference_type n) noexcept {
+      return it += n;
+    }
+    friend const_iterator operator+(difference_type n,
+                                    const_iterator it) noexcept {
+      return it += n;
+    }
+    friend const_iterator operator-(const_iterator it,
+                                    difference_type n) noexcept {
+      return it -= n;
+    }
+    friend difference_type operator-(const_iterator const& a,
+                                     const_iterator const& b) noexcept {
+      return difference_type(a.index_) - difference_type(b.index_);
+    }
+
+    friend bool operator==(const_iterator const& a,
+                           const_iterator const& b) noexcept {
+      return a.index_ == b.index_;
+    }
+    friend bool operator!=(const_iterator const& a,
+                           const_iterator const& b) noexcept {
+      return a.index_ != b.index_;
+    }
+    friend bool operator<(const_iterator const& a,
+                          const_iterator const& b) noexcept {
+      return a.index_ < b.index_;
+    }
+    friend bool operator>(const_iterator const& a,
+                          const_iterator const& b) noexcept {
+      return b < a;
+    }
+    friend bool operator<=(const_iterator const& a,
+                           const_iterator const& b) noexcept {
+      return !(b < a);
+    }
+    friend bool operator>=(const_iterator const& a,
+                           const_iterator const& b) noexcept {
+      return !(a < b);
+    }
+
+   private:
+    friend class persistent_vector;
+
+    const_iterator(persistent_vector const* v, size_t index) noexcept
+        : v_(v), index_(index), leaf_(nullptr), first_(0), last_(0) {}
+
+    persistent_vector const* v_;
+    size_t index_;
+    // The cached leaf holds elements [first_, last_).
+    mutable T const* leaf_;
+    mutable size_t first_;
+    mutable size_t last_;
+  };
+  typedef const_iterator iterator;
+  typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+  typedef const_reverse_iterator reverse_iterator;
+
+  persistent_vector() noexcept : root_(nullptr), size_(0), shift_(0) {}
+  persistent_vector(persistent_vector const& other) noexcept
+      : root_(other.root_), size_(other.size_), shift_(other.shift_) {
+    if (root_) acquire(root_);
+  }
+  persistent_vector(persistent_vector&& other) noexcept
+      : root_(std::exchange(other.root_, nullptr)),
+        size_(std::exchange(other.size_, 0)),
+        shift_(std::exchange(other.shift_, 0)) {}
+  persistent_vector& operator=(persistent_vector other) noexcept {
+    swap(*this, other);
+    return *this;
+  }
+  ~persistent_vector() {
+    if (root_) release(root_);
+  }
+
+  bool empty() const noexcept { return size_ == 0; }
+  size_t size() const noexcept { return size_; }
+  void clear() noexcept { persistent_vector().swap_with(*this); }
+
+  const_reference operator[](size_t index) const noexcept {
+    return locate(index)->data()[index];
+  }
+  const_reference front() const noexcept { return (*this)[0]; }
+  const_reference back() const noexcept { return (*this)[size_ - 1]; }
+
+  const_iterator begin() const noexcept { return const_iterator(this, 0); }
+  const_iterator end() const noexcept { return const_iterator(this, size_); }
+  const_reverse_iterator rbegin() const noexcept {
+    return const_reverse_iterator(end());
+  }
+  const_reverse_iterator rend() const noexcept {
+    return const_reverse_iterator(begin());
+  }
+
+  template <typename U>
+  void set(size_t index, U&& value) {
+    node* n = own(root_);
+    for (unsigned shift = shift_; shift != 0; shift -= BITS) {
+      inner_node* in = as_inner(n);
+      n = own(in->children[slot_of(in, shift, index)]);
+    }
+    as_leaf(n)->data()[index] = std::forward<U>(value);
+  }
+
+  void push_back(const_reference v) { emplace_back(v); }
+  void push_back(T&& v) { emplace_back(std::move(v)); }
+
+  template <typename... Args>
+  void emplace_back(Args&&... args) {
+    if (!root_) {
+      ref r(new leaf_node());
+      new (as_leaf(r.get())->data()) T(std::forward<Args>(args)...);
+      r.get()->count = 1;
+      root_ = r.take();
+      size_ = 1;
+      return;
+    }
+    // The deepest node on the right edge with a free slot, if any.
+    bool room = false;
+    unsigned room_shift = 0;
+    node* n = root_;
+    for (unsigned shift = shift_;; shift -= BITS) {
+      if (n->count < WIDTH) {
+        room = true;
+        room_shift = shift;
+      }
+      if (shift == 0) break;
+      n = as_inner(n)->children[n->count - 1];
+    }
+
+    // Whatever is new is built first, so a throw leaves the tree as is.
+    ref branch;
+    if (!room || room_shift != 0) {
+      ref l(new leaf_node());
+      new (as_leaf(l.get())->data()) T(std::forward<Args>(args)...);
+      l.get()->count = 1;
+      branch = ref(new_path(room ? room_shift - BITS : shift_, l.take()));
+    }
+    if (!room) {
+      inner_node* r = new inner_node();
+      push_child(r, root_, shift_ + BITS);
+      push_child(r, branch.take(), shift_ + BITS);
+      root_ = r;
+      shift_ += BITS;
+      ++size_;
+      return;
+    }
+
+    inner_node* path[sizeof(size_t) * 8 / BITS + 1];
+    unsigned depth = 0;
+    n = own(root_);
+    for (unsigned shift = shift_; shift != room_shift; shift -= BITS) {
+      inner_node* in = as_inner(n);
+      path[depth++] = in;
+      n = own(in->children[in->count - 1]);
+    }
+    if (room_shift == 0) {
+      new (as_leaf(n)->data() + n->count) T(std::forward<Args>(args)...);
+      ++n->count;
+    } else {
+      push_child(as_inner(n), branch.take(), room_shift);
+    }
+    for (unsigned i = 0; i != depth; ++i) ++path[i]->sizes[path[i]->count - 1];
+    ++size_;
+  }
+
+  void pop_back() {
+    own(root_);
+    // Every node on the right edge has to be owned before pop() runs.
+    node* n = root_;
+    for (unsigned shift = shift_; shift != 0; shift -= BITS) {
+      inner_node* in = as_inner(n);
+      n = own(in->children[in->count - 1]);
+    }
+    if (pop(root_, shift_)) {
+      release(root_);
+      root_ = nullptr;
+      shift_ = 0;
+    } else {
+      collapse();
+    }
+    --size_;
+  }
+
+  /** Elements [first, last), sharing all nodes but those along the cuts. */
+  persistent_vector slice(size_t first, size_t last) const {
+    if (first >= last) return persistent_vector();
+    ref head(take(root_, shift_, last));
+    return persistent_vector(drop(head.get(), shift_, first), shift_);
+  }
+  friend persistent_vector concat(persistent_vector const& a,
+                                  persistent_vector const& b) {
+    if (a.empty()) return b;
+    if (b.empty()) return a;
+    if (a.shift_ == 0 && b.shift_ == 0 && a.size_ + b.size_ <= WIDTH) {
+      ref r(new leaf_node());
+      leaf_node* l = as_leaf(r.get());
+      for (auto const* v : {&a, &b})
+        for (unsigned i = 0; i != v->size_; ++i, ++l->count)
+          new (l->data() + l->count) T(as_leaf(v->root_)->data()[i]);
+      return persistent_vector(r.take(), 0);
+    }
+    node_list top;
+    merge(a.root_, a.shift_, b.root_, b.shift_, top);
+    unsigned shift = std::max(a.shift_, b.shift_);
+    if (top.count == 1) {
+      return persistent_vector(std::exchange(top.items[0], nullptr), shift);
+    }
+    inner_node* r = new inner_node();
+    for (unsigned i = 0; i != top.count; ++i)
+      push_child(r, std::exchange(top.items[i], nullptr), shift + BITS);
+    return persistent_vector(r, shift + BITS);
+  }
+
+  friend void swap(persistent_vector& a, persistent_vector& b) noexcept {
+    a.swap_with(b);
+  }
+
+ private:
+  void swap_with(persistent_vector& other) noexcept {
+    std::swap(root_, other.root_);
+    std::swap(size_, other.size_);
+    std::swap(shift_, other.shift_);
+  }
+};
@@ -0,0 +1,223 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <vector>
+#include "counted.h"
+#include "fault_injection.h"
+#include "persistent_vector.h"
+
+typedef persistent_vector<counted> container;
+typedef persistent_vector<int> container_int;
+
+namespace {
+template <typename C>
+void expect_same(std::vector<int> const& expected, C const& c) {
+  ASSERT_EQ(expected.size(), c.size());
+  for (size_t i = 0; i != expected.size(); ++i) ASSERT_EQ(expected[i], c[i]);
+  size_t i = 0;
+  for (auto it = c.begin(); it != c.end(); ++it, ++i)
+    ASSERT_EQ(expected[i], *it);
+}
+
+container_int make(int first, int count) {
+  container_int c;
+  for (int i = 0; i != count; ++i) c.push_back(first + i);
+  return c;
+}
+
+std::vector<int> iota(int first, int count) {
+  std::vector<int> v;
+  for (int i = 0; i != count; ++i) v.push_back(first + i);
+  return v;
+}
+}  // namespace
+
+TEST(correctness, default_ctor) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    EXPECT_TRUE(c.empty());
+    EXPECT_EQ(0u, c.size());
+    EXPECT_EQ(c.begin(), c.end());
+  });
+}
+
+TEST(correctness, push_back) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    for (int i = 0; i != 2000; ++i) c.push_back(i);
+    EXPECT_EQ(2000u, c.size());
+    for (int i = 0; i != 2000; ++i) EXPECT_EQ(i, c[i]);
+    EXPECT_EQ(0, c.front());
+    EXPECT_EQ(1999, c.back());
+  });
+}
+
+TEST(correctness, push_back_deep) {
+  container_int c = make(0, 40000);
+  expect_same(iota(0, 40000), c);
+}
+
+TEST(correctness, copies_are_independent) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    for (int i = 0; i != 100; ++i) c.push_back(i);
+    container d = c;
+    d.set(50, -50);
+    d.push_back(100);
+    c.pop_back();
+    EXPECT_EQ(50, c[50]);
+    EXPECT_EQ(-50, d[50]);
+    EXPECT_EQ(99u, c.size());
+    EXPECT_EQ(101u, d.size());
+    EXPECT_EQ(99, d[99]);
+    EXPECT_EQ(&c[0], &d[0]);
+    EXPECT_EQ(&c[70], &d[70]);
+    EXPECT_NE(&c[40], &d[40]);
+  });
+}
+
+TEST(correctness, set_in_place_when_unique) {
+  container_int c = make(0, 100);
+  int const* p = &c[10];
+  c.set(10, 42);
+  EXPECT_EQ(p, &c[10]);
+  EXPECT_EQ(42, c[10]);
+}
+
+TEST(correctness, pop_back) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    for (int i = 0; i != 1100; ++i) c.push_back(i);
+    container d = c;
+    while (c.size() > 3) c.pop_back();
+    EXPECT_EQ(2, c.back());
+    EXPECT_EQ(1099, d.back());
+    while (!c.empty()) c.pop_back();
+    c.push_back(7);
+    EXPECT_EQ(7, c[0]);
+  });
+}
+
+TEST(correctness, slice) {
+  container_int c = make(0, 5000);
+  expect_same(iota(1000, 2000), c.slice(1000, 3000));
+  expect_same(iota(7, 3), c.slice(7, 10));
+  expect_same(iota(0, 5000), c.slice(0, 5000));
+  EXPECT_TRUE(c.slice(10, 10).empty());
+  container_int s = c.slice(33, 4100);
+  s.push_back(-1);
+  s.set(0, -2);
+  EXPECT_EQ(-2, s[0]);
+  EXPECT_EQ(-1, s.back());
+  EXPECT_EQ(33, c[33]);
+  expect_same(iota(100, 900), s.slice(67, 967));
+}
+
+TEST(correctness, concat) {
+  expect_same(iota(0, 30), concat(make(0, 10), make(10, 20)));
+  expect_same(iota(0, 70), concat(make(0, 40), make(40, 30)));
+  expect_same(iota(0, 5000), concat(make(0, 1), make(1, 4999)));
+  expect_same(iota(0, 5000), concat(make(0, 4999), make(4999, 1)));
+  expect_same(iota(0, 70000), concat(make(0, 35000), make(35000, 35000)));
+  expect_same(iota(0, 10), concat(container_int(), make(0, 10)));
+}
+
+TEST(correctness, concat_many_small) {
+  container_int c;
+  std::vector<int> expected;
+  int next = 0;
+  for (int k = 0; k != 500; ++k) {
+    int n = k % 7 + 1;
+    c = concat(c, make(next, n));
+    for (int i = 0; i != n; ++i) expected.push_back(next + i);
+    next += n;
+  }
+  expect_same(expected, c);
+  c.push_back(-1);
+  expected.push_back(-1);
+  c.set(1234, 0);
+  expected[1234] = 0;
+  expect_same(expected, c);
+}
+
+TEST(correctness, random_operations) {
+  std::mt19937 rng(12345);
+  container_int c;
+  std::vector<int> expected;
+  std::vector<container_int> versions;
+  std::vector<std::vector<int>> expected_versions;
+  for (int step = 0; step != 3000; ++step) {
+    switch (rng() % 6) {
+      case 0:
+      case 1: {
+        int v = rng() % 1000;
+        c.push_back(v);
+        expected.push_back(v);
+        break;
+      }
+      case 2:
+        if (!expected.empty()) {
+          size_t i = rng() % expected.size();
+          c.set(i, step);
+          expected[i] = step;
+        }
+        break;
+      case 3:
+        if (!expected.empty()) {
+          c.pop_back();
+          expected.pop_back();
+        }
+        break;
+      case 4: {
+        int n = rng() % 100;
+        container_int other;
+        for (int i = 0; i != n; ++i) other.push_back(-i);
+        if (rng() % 2) {
+          c = concat(c, other);
+          for (int i = 0; i != n; ++i) expected.push_back(-i);
+        } else {
+          c = concat(other, c);
+          std::vector<int> front;
+          for (int i = 0; i != n; ++i) front.push_back(-i);
+          expected.insert(expected.begin(), front.begin(), front.end());
+        }
+        break;
+      }
+      case 5:
+        if (!expected.empty()) {
+          size_t first = rng() % expected.size();
+          size_t last = first + rng() % (expected.size() - first + 1);
+          c = c.slice(first, last);
+          expected = std::vector<int>(expected.begin() + first,
+                                      expected.begin() + last);
+        }
+        break;
+    }
+    if (step % 100 == 0) {
+      versions.push_back(c);
+      expected_versions.push_back(expected);
+    }
+  }
+  expect_same(expected, c);
+  for (size_t i = 0; i != versions.size(); ++i)
+    expect_same(expected_versions[i], versions[i]);
+}
+
+TEST(correctness, concat_counted) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container a, b;
+    for (int i = 0; i != 100; ++i) a.push_back(i);
+    for (int i = 0; i != 50; ++i) b.push_back(100 + i);
+    container c = concat(a, b);
+    container d = concat(c.slice(10, 140), a);
+    EXPECT_EQ(150u, c.size());
+    EXPECT_EQ(230u, d.size());
+    for (int i = 0; i != 150; ++i) EXPECT_EQ(i, c[i]);
+    EXPECT_EQ(10, d[0]);
+    EXPECT_EQ(0, d[130]);
+  });
+}
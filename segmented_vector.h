@@ -0,0 +1,354 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace detail {
+/** Largest power of two of elements that fits in a 4 KiB chunk, at
+ * least 16. */
+template <typename T>
+constexpr size_t default_chunk_size() {
+  size_t n = 16;
+  while (n * 2 * sizeof(T) <= 4096) n *= 2;
+  return n;
+}
+}  // namespace detail
+
+/**
+ * Vector stored in fixed-size chunks behind a copy-on-write chunk table.
+ * Growing never moves elements, so references stay valid while it grows.
+ * Copies share everything; a write to a copy clones the table (pointers
+ * only) and the one chunk written to.
+ */
+template <typename T, size_t ChunkSize = detail::default_chunk_size<T>()>
+class segmented_vector {
+  static_assert(ChunkSize > 0 && (ChunkSize & (ChunkSize - 1)) == 0,
+                "chunk size must be a power of two");
+  static constexpr size_t MASK = ChunkSize - 1;
+  static constexpr size_t DEFAULT_TABLE_SIZE = 4;
+
+  /** Elements [0, size) are alive. Only chunks with one owner change. */
+  struct chunk {
+    std::atomic<size_t> owners;
+    size_t size;
+    alignas(T) unsigned char storage[ChunkSize * sizeof(T)];
+
+    chunk() : owners(1), size(0) {}
+
+    T* data() noexcept { return std::launder(reinterpret_cast<T*>(storage)); }
+    bool shared() { return owners.load(std::memory_order_acquire) > 1; }
+    void acquire() { owners.fetch_add(1, std::memory_order_relaxed); }
+    void release() {
+      if (owners.fetch_sub(1, std::memory_order_release) == 1) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        std::destroy_n(data(), size);
+        delete this;
+      }
+    }
+  };
+
+  /** all_owned: no chunk is shared with another table, set by begin().
+   * Atomic only because copies sharing the table clear it when they clone.
+   */
+  struct table {
+    std::atomic<size_t> owners;
+    std::atomic<bool> all_owned;
+    size_t capacity;
+    size_t count;
+    chunk* chunks[];
+
+    explicit table(size_t capacity)
+        : owners(1), all_owned(false), capacity(capacity), count(0) {}
+
+    bool shared() { return owners.load(std::memory_order_acquire) > 1; }
+    void acquire() { owners.fetch_add(1, std::memory_order_relaxed); }
+    void release() {
+      if (owners.fetch_sub(1, std::memory_order_release) == 1) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        for (size_t i = 0; i != count; ++i) chunks[i]->release();
+        operator delete(this);
+      }
+    }
+  };
+
+  /** Invariant: table_ holds ceil(size_ / ChunkSize) chunks, all full
+   * except the last; table_ is null only while nothing was allocated.
+   */
+  table* table_;
+  size_t size_;
+
+  static table* new_table(size_t capacity) {
+    void* mem =
+        operator new(offsetof(table, chunks) + capacity * sizeof(chunk*));
+    return new (mem) table(capacity);
+  }
+  /** Makes table_ unique with room for at least capacity chunks. Chunks
+   * are shared with the old table, not copied.
+   */
+  void own_table(size_t capacity) {
+    if (table_ && !table_->shared() && table_->capacity >= capacity) return;
+    size_t count = table_ ? table_->count : 0;
+    if (table_) capacity = std::max(capacity, table_->capacity);
+    table* t = new_table(std::max(capacity, DEFAULT_TABLE_SIZE));
+    if (!table_) {
+      table_ = t;
+      return;
+    }
+    std::copy_n(table_->chunks, count, t->chunks);
+    t->count = count;
+    if (table_->shared()) {
+      for (size_t i = 0; i != count; ++i) t->chunks[i]->acquire();
+      table_->all_owned.store(false, std::memory_order_relaxed);
+      table_->release();
+    } else {
+      t->all_owned.store(table_->all_owned.load(std::memory_order_relaxed),
+                         std::memory_order_relaxed);
+      operator delete(table_);
+    }
+    table_ = t;
+  }
+  /** Chunk k, made unique; a shared chunk is cloned keeping its first
+   * keep elements.
+   */
+  chunk* own_chunk(size_t k, size_t keep = ChunkSize) {
+    own_table(table_->capacity);
+    chunk* c = table_->chunks[k];
+    if (!c->shared()) return c;
+    chunk* n = new chunk();
+    keep = std::min(keep, c->size);
+    try {
+      std::uninitialized_copy_n(c->data(), keep, n->data());
+    } catch (...) {
+      delete n;
+      throw;
+    }
+    n->size = keep;
+    table_->chunks[k] = n;
+    c->release();
+    return n;
+  }
+  T const& get(size_t index) const noexcept {
+    return table_->chunks[index / ChunkSize]->data()[index & MASK];
+  }
+
+  template <typename C>
+  struct iterator_t {
+    using difference_type = std::ptrdiff_t;
+    using value_type = T;
+    using pointer = C*;
+    using reference = C&;
+    using iterator_category = std::random_access_iterator_tag;
+
+    chunk* const* chunks;
+    size_t index;
+
+    iterator_t() noexcept : chunks(nullptr), index(0) {}
+    iterator_t(chunk* const* chunks, size_t index) noexcept
+        : chunks(chunks), index(index) {}
+    template <typename D,
+              typename = std::enable_if_t<std::is_convertible_v<D*, C*>>>
+    iterator_t(iterator_t<D> const& other) noexcept
+        : chunks(other.chunks), index(other.index) {}
+
+    reference operator*() const noexcept {
+      return chunks[index / ChunkSize]->data()[index & MASK];
+    }
+    pointer operator->() const noexcept { return &**this; }
+    reference operator[](difference_type n) const noexcept {
+      return *(*this + n);
+    }
+
+    iterator_t& operator++() noexcept {
+      ++index;
+      return *this;
+    }
+    iterator_t operator++(int) noexcept {
+      iterator_t old = *this;
+      ++index;
+      return old;
+    }
+    iterator_t& operator--() noexcept {
+      --index;
+      return *this;
+    }
+    iterator_t operator--(int) noexcept {
+      iterator_t old = *this;
+      --index;
+      return old;
+    }
+    iterator_t& operator+=(difference_type n) noexcept {
+      index += n;
+      return *this;
+    }
+    iterator_t& operator-=(difference_type n) noexcept {
+      index -= n;
+      return *this;
+    }
+    friend iterator_t operator+(iterator_t it, difference_type n) noexcept {
+      return it += n;
+    }
+    friend iterator_t operator+(difference_type n, iterator_t it) noexcept {
+      return it += n;
+    }
+    friend iterator_t operator-(iterator_t it, difference_type n) noexcept {
+      return it -= n;
+    }
+    friend difference_type operator-(iterator_t const& a,
+                                     iterator_t const& b) noexcept {
+      return difference_type(a.index) - difference_type(b.index);
+    }
+
+    friend bool operator==(iterator_t const& a, iterator_t const& b) noexcept {
+      return a.index == b.index;
+    }
+    friend bool operator!=(iterator_t const& a, iterator_t const& b) noexcept {
+      return a.index != b.index;
+    }
+    friend bool operator<(iterator_t const& a, iterator_t const& b) noexcept {
+      return a.index < b.index;
+    }
+    friend bool operator>(iterator_t const& a, iterator_t const& b) noexcept {
+      return b < a;
+    }
+    friend bool operator<=(iterator_t const& a, iterator_t const& b) noexcept {
+      return !(b < a);
+    }
+    friend bool operator>=(iterator_t const& a, iterator_t const& b) noexcept {
+      return !(a < b);
+    }
+  };
+
+ public:
+  typedef T value_type;
+  typedef T const& const_reference;
+  typedef T& reference;
+  typedef iterator_t<T const> const_iterator;
+  typedef iterator_t<T> iterator;
+  typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+  typedef std::reverse_iterator<iterator> reverse_iterator;
+
+  static constexpr size_t chunk_size = ChunkSize;
+
+  segmented_vector() noexcept : table_(nullptr), size_(0) {}
+  segmented_vector(segmented_vector const& other) noexcept
+      : table_(other.table_), size_(other.size_) {
+    if (table_) table_->acquire();
+  }
+  segmented_vector(segmented_vector&& other) noexcept
+      : table_(other.table_), size_(other.size_) {
+    other.table_ = nullptr;
+    other.size_ = 0;
+  }
+  segmented_vector& operator=(segmented_vector other) noexcept {
+    swap(*this, other);
+    return *this;
+  }
+  ~segmented_vector() {
+    if (table_) table_->release();
+  }
+
+  bool empty() const noexcept { return size_ == 0; }
+  size_t size() const noexcept { return size_; }
+  void clear() noexcept {
+    if (table_) table_->release();
+    table_ = nullptr;
+    size_ = 0;
+  }
+
+  const_reference operator[](size_t index) const noexcept {
+    return get(index);
+  }
+  reference operator[](size_t index) {
+    return own_chunk(index / ChunkSize)->data()[index & MASK];
+  }
+  const_reference front() const noexcept { return get(0); }
+  const_reference back() const noexcept { return get(size_ - 1); }
+  reference front() { return (*this)[0]; }
+  reference back() { return (*this)[size_ - 1]; }
+
+  const_iterator begin() const noexcept {
+    return const_iterator(table_ ? table_->chunks : nullptr, 0);
+  }
+  const_iterator end() const noexcept {
+    return const_iterator(table_ ? table_->chunks : nullptr, size_);
+  }
+  /** Clones every chunk still shared with a copy. */
+  iterator begin() {
+    if (!table_) return iterator();
+    own_table(table_->capacity);
+    for (size_t k = 0; k != table_->count; ++k) own_chunk(k);
+    table_->all_owned.store(true, std::memory_order_relaxed);
+    return iterator(table_->chunks, 0);
+  }
+  iterator end() {
+    if (table_ && !table_->shared() &&
+        table_->all_owned.load(std::memory_order_relaxed))
+      return iterator(table_->chunks, size_);
+    return begin() + size_;
+  }
+
+  const_reverse_iterator rbegin() const noexcept {
+    return const_reverse_iterator(end());
+  }
+  const_reverse_iterator rend() const noexcept {
+    return const_reverse_iterator(begin());
+  }
+  reverse_iterator rbegin() { return reverse_iterator(end()); }
+  reverse_iterator rend() { return reverse_iterator(begin()); }
+
+  void push_back(const_reference v) { emplace_back(v); }
+  void push_back(T&& v) { emplace_back(std::move(v)); }
+
+  template <typename... Args>
+  reference emplace_back(Args&&... args) {
+    size_t k = size_ / ChunkSize;
+    size_t i = size_ & MASK;
+    chunk* c;
+    if (i == 0) {
+      own_table(table_ && table_->capacity == k ? k * 2 : k + 1);
+      c = new chunk();
+      try {
+        new (c->data()) T(std::forward<Args>(args)...);
+      } catch (...) {
+        delete c;
+        throw;
+      }
+      table_->chunks[k] = c;
+      ++table_->count;
+    } else {
+      c = own_chunk(k);
+      new (c->data() + i) T(std::forward<Args>(args)...);
+    }
+    ++c->size;
+    ++size_;
+    return c->data()[i];
+  }
+
+  void pop_back() {
+    size_t last = size_ - 1;
+    size_t k = last / ChunkSize;
+    if ((last & MASK) == 0) {
+      own_table(table_->capacity);
+      table_->chunks[k]->release();
+      --table_->count;
+    } else {
+      chunk* c = own_chunk(k, last & MASK);
+      if (c->size > (last & MASK)) {
+        c->data()[last & MASK].~T();
+        --c->size;
+      }
+    }
+    --size_;
+  }
+
+  friend void swap(segmented_vector& a, segmented_vector& b) noexcept {
+    std::swap(a.table_, b.table_);
+    std::swap(a.size_, b.size_);
+  }
+};
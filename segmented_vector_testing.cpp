@@ -0,0 +1,151 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <numeric>
+#include <string>
+#include "counted.h"
+#include "fault_injection.h"
+#include "segmented_vector.h"
+
+typedef segmented_vector<counted, 4> container;
+typedef segmented_vector<int> container_int;
+
+TEST(correctness, default_ctor) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    EXPECT_TRUE(c.empty());
+    EXPECT_EQ(0u, c.size());
+    EXPECT_EQ(c.begin(), c.end());
+  });
+}
+
+TEST(correctness, push_back) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    for (int i = 0; i != 100; ++i) c.push_back(i);
+    EXPECT_EQ(100u, c.size());
+    container const& cc = c;
+    for (int i = 0; i != 100; ++i) EXPECT_EQ(i, cc[i]);
+    EXPECT_EQ(0, cc.front());
+    EXPECT_EQ(99, cc.back());
+  });
+}
+
+TEST(correctness, stable_references) {
+  faulty_run([] {
+    container_int c;
+    c.push_back(42);
+    int const* first = &std::as_const(c)[0];
+    for (int i = 1; i != 100000; ++i) c.push_back(i);
+    EXPECT_EQ(first, &std::as_const(c)[0]);
+    EXPECT_EQ(42, *first);
+  });
+}
+
+TEST(correctness, copy_clones_touched_chunk) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    for (int i = 0; i != 12; ++i) c.push_back(i);
+    container d = c;
+    container const& cc = c;
+    container const& cd = d;
+    EXPECT_EQ(&cc[5], &cd[5]);
+
+    d[5] = 50;
+    EXPECT_EQ(5, cc[5]);
+    EXPECT_EQ(50, cd[5]);
+    EXPECT_NE(&cc[5], &cd[5]);
+    EXPECT_EQ(&cc[0], &cd[0]);
+    EXPECT_EQ(&cc[11], &cd[11]);
+
+    d.push_back(12);
+    c.push_back(-12);
+    EXPECT_EQ(12, cd[12]);
+    EXPECT_EQ(-12, cc[12]);
+    EXPECT_EQ(&cc[11], &cd[11]);
+  });
+}
+
+TEST(correctness, append_to_shared_chunk) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    for (int i = 0; i != 6; ++i) c.push_back(i);
+    container d = c;
+    c.push_back(6);
+    d.push_back(-6);
+    EXPECT_EQ(6, std::as_const(c)[6]);
+    EXPECT_EQ(-6, std::as_const(d)[6]);
+    EXPECT_EQ(5, std::as_const(d)[5]);
+  });
+}
+
+TEST(correctness, pop_back) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    for (int i = 0; i != 9; ++i) c.push_back(i);
+    container d = c;
+    c.pop_back();
+    c.pop_back();
+    EXPECT_EQ(7u, c.size());
+    EXPECT_EQ(6, std::as_const(c).back());
+    EXPECT_EQ(8, std::as_const(d).back());
+    while (!d.empty()) d.pop_back();
+    d.push_back(1);
+    EXPECT_EQ(1u, d.size());
+    EXPECT_EQ(6, std::as_const(c).back());
+  });
+}
+
+TEST(correctness, iterators) {
+  faulty_run([] {
+    container_int c;
+    for (int i = 0; i != 1000; ++i) c.push_back(999 - i);
+    container_int d = c;
+    std::sort(c.begin(), c.end());
+    for (int i = 0; i != 1000; ++i) EXPECT_EQ(i, std::as_const(c)[i]);
+    EXPECT_EQ(999, std::as_const(d)[0]);
+    container_int const& cd = d;
+    EXPECT_EQ(999 * 1000 / 2, std::accumulate(cd.begin(), cd.end(), 0));
+    EXPECT_EQ(0, *cd.rbegin());
+    EXPECT_EQ(1000, cd.end() - cd.begin());
+  });
+}
+
+TEST(correctness, explicit_end_loop) {
+  faulty_run([] {
+    container_int c;
+    for (int i = 0; i != 100000; ++i) c.push_back(i);
+    container_int d = c;
+    for (auto it = c.begin(); it != c.end(); ++it) *it += 1;
+    EXPECT_EQ(1, std::as_const(c)[0]);
+    EXPECT_EQ(0, std::as_const(d)[0]);
+
+    // e clones c's table and one chunk: c is again the only owner of its
+    // table, but the other chunks are shared and have to be cloned first.
+    container_int e = c;
+    e[0] = -1;
+    *(c.end() - 1) = 7;
+    EXPECT_EQ(100000, std::as_const(e)[99999]);
+    *(c.end() - 1) = 100000;
+    for (auto it = c.begin(); it != c.end(); ++it) *it -= 1;
+    container_int const& cc = c;
+    for (int i = 0; i != 100000; ++i) ASSERT_EQ(i, cc[i]);
+    EXPECT_EQ(100000, std::as_const(e)[99999]);
+    EXPECT_EQ(-1, std::as_const(e)[0]);
+  });
+}
+
+TEST(correctness, strings) {
+  segmented_vector<std::string, 2> c;
+  for (int i = 0; i != 10; ++i) c.push_back(std::to_string(i));
+  auto d = c;
+  d.back() += "!";
+  c.clear();
+  EXPECT_TRUE(c.empty());
+  EXPECT_EQ("9!", std::as_const(d).back());
+  EXPECT_EQ("0", std::as_const(d).front());
+}
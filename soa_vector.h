@@ -0,0 +1,226 @@
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "vector.h"
+
+/**
+ * Records stored field by field: each field lives in its own contiguous
+ * copy-on-write column, so a scan over one field touches only that
+ * field's memory, and writing one field of a shared soa_vector copies
+ * only that column. Rows are read and written as tuples of references.
+ */
+template <typename... Fields>
+class soa_vector {
+  static_assert(sizeof...(Fields) > 0, "soa_vector needs at least one field");
+
+  /** Advances one iterator per column in lockstep. */
+  template <typename... Its>
+  struct iterator_t {
+    using difference_type = std::ptrdiff_t;
+    using value_type =
+        std::tuple<typename std::iterator_traits<Its>::value_type...>;
+    using pointer = void;
+    using reference =
+        std::tuple<typename std::iterator_traits<Its>::reference...>;
+    using iterator_category = std::random_access_iterator_tag;
+
+    std::tuple<Its...> its;
+
+    iterator_t() noexcept = default;
+    explicit iterator_t(Its... its) noexcept : its(its...) {}
+    template <typename... Others,
+              typename = std::enable_if_t<
+                  (std::is_convertible_v<Others, Its> && ...)>>
+    iterator_t(iterator_t<Others...> const& other) noexcept
+        : its(other.its) {}
+
+    reference operator*() const noexcept {
+      return std::apply([](auto const&... it) { return reference(*it...); },
+                        its);
+    }
+    reference operator[](difference_type n) const noexcept {
+      return *(*this + n);
+    }
+
+    iterator_t& operator++() noexcept { return *this += 1; }
+    iterator_t operator++(int) noexcept {
+      iterator_t old = *this;
+      *this += 1;
+      return old;
+    }
+    iterator_t& operator--() noexcept { return *this -= 1; }
+    iterator_t operator--(int) noexcept {
+      iterator_t old = *this;
+      *this -= 1;
+      return old;
+    }
+    iterator_t& operator+=(difference_type n) noexcept {
+      std::apply([n](auto&... it) { ((it += n), ...); }, its);
+      return *this;
+    }
+    iterator_t& operator-=(difference_type n) noexcept { return *this += -n; }
+    friend iterator_t operator+(iterator_t it, difference_type n) noexcept {
+      return it += n;
+    }
+    friend iterator_t operator+(difference_type n, iterator_t it) noexcept {
+      return it += n;
+    }
+    friend iterator_t operator-(iterator_t it, difference_type n) noexcept {
+      return it -= n;
+    }
+    friend difference_type operator-(iterator_t const& a,
+                                     iterator_t const& b) noexcept {
+      return std::get<0>(a.its) - std::get<0>(b.its);
+    }
+
+    friend bool operator==(iterator_t const& a, iterator_t const& b) noexcept {
+      return std::get<0>(a.its) == std::get<0>(b.its);
+    }
+    friend bool operator!=(iterator_t const& a, iterator_t const& b) noexcept {
+      return !(a == b);
+    }
+    friend bool operator<(iterator_t const& a, iterator_t const& b) noexcept {
+      return std::get<0>(a.its) < std::get<0>(b.its);
+    }
+    friend bool operator>(iterator_t const& a, iterator_t const& b) noexcept {
+      return b < a;
+    }
+    friend bool operator<=(iterator_t const& a, iterator_t const& b) noexcept {
+      return !(b < a);
+    }
+    friend bool operator>=(iterator_t const& a, iterator_t const& b) noexcept {
+      return !(a < b);
+    }
+  };
+
+  /** Invariant: all columns have the same size. */
+  std::tuple<vector<Fields>...> columns_;
+
+ public:
+  typedef std::tuple<Fields...> value_type;
+  typedef std::tuple<typename vector<Fields>::reference...> reference;
+  typedef std::tuple<typename vector<Fields>::const_reference...>
+      const_reference;
+  typedef iterator_t<typename vector<Fields>::const_iterator...>
+      const_iterator;
+  typedef iterator_t<typename vector<Fields>::iterator...> iterator;
+
+  template <size_t I>
+  using column_type = vector<std::tuple_element_t<I, value_type>>;
+
+ private:
+  template <typename... Args, size_t... I>
+  void push_row(std::index_sequence<I...>, Args&&... values) {
+    size_t pushed = 0;
+    try {
+      ((std::get<I>(columns_).push_back(std::forward<Args>(values)),
+        ++pushed),
+       ...);
+    } catch (...) {
+      // Can't throw: a column that took its value owns its buffer now,
+      // or is a bool column whose new bit is clear, which pops in place.
+      ((I < pushed ? std::get<I>(columns_).pop_back() : void()), ...);
+      throw;
+    }
+  }
+  template <size_t... I>
+  const_reference row(size_t index, std::index_sequence<I...>) const noexcept {
+    return const_reference(std::get<I>(columns_)[index]...);
+  }
+  template <size_t... I>
+  reference row(size_t index, std::index_sequence<I...>) {
+    return reference(std::get<I>(columns_)[index]...);
+  }
+
+ public:
+  bool empty() const noexcept { return size() == 0; }
+  size_t size() const noexcept { return std::get<0>(columns_).size(); }
+  void clear() {
+    std::apply([](auto&... c) { (c.clear(), ...); }, columns_);
+  }
+  void reserve(size_t new_capacity) {
+    std::apply([new_capacity](auto&... c) { (c.reserve(new_capacity), ...); },
+               columns_);
+  }
+
+  /** Field I of every row, contiguous; the column stays shared. */
+  template <size_t I>
+  column_type<I> const& column() const noexcept {
+    return std::get<I>(columns_);
+  }
+  /** Writable view of column I, detaching that column only. A bool
+   * column's view yields proxy references, as vector<bool> does.
+   */
+  template <size_t I>
+  typename column_type<I>::span mutable_column() {
+    return std::get<I>(columns_).mutable_span();
+  }
+  template <size_t I>
+  typename column_type<I>::const_reference field(size_t index) const noexcept {
+    return std::get<I>(columns_)[index];
+  }
+  template <size_t I>
+  typename column_type<I>::reference field(size_t index) {
+    return std::get<I>(columns_)[index];
+  }
+
+  const_reference operator[](size_t index) const noexcept {
+    return row(index, std::index_sequence_for<Fields...>());
+  }
+  /** Detaches every column; use field() to write a single one. */
+  reference operator[](size_t index) {
+    return row(index, std::index_sequence_for<Fields...>());
+  }
+  const_reference front() const noexcept { return (*this)[0]; }
+  const_reference back() const noexcept { return (*this)[size() - 1]; }
+  reference front() { return (*this)[0]; }
+  reference back() { return (*this)[size() - 1]; }
+
+  const_iterator begin() const noexcept {
+    return std::apply(
+        [](auto const&... c) { return const_iterator(c.begin()...); },
+        columns_);
+  }
+  const_iterator end() const noexcept {
+    return std::apply(
+        [](auto const&... c) { return const_iterator(c.end()...); }, columns_);
+  }
+  iterator begin() {
+    return std::apply([](auto&... c) { return iterator(c.begin()...); },
+                      columns_);
+  }
+  iterator end() {
+    return std::apply([](auto&... c) { return iterator(c.end()...); },
+                      columns_);
+  }
+
+  /** Appends a row, one value per field. Strong guarantee. */
+  template <typename... Args>
+  void push_back(Args&&... values) {
+    static_assert(sizeof...(Args) == sizeof...(Fields),
+                  "push_back takes one value per field");
+    push_row(std::index_sequence_for<Fields...>(),
+             std::forward<Args>(values)...);
+  }
+  void pop_back() {
+    // Detach everything first, so that no column pops before a throw.
+    std::apply([](auto&... c) { ((void)c.mutable_span(), ...); }, columns_);
+    std::apply([](auto&... c) { (c.pop_back(), ...); }, columns_);
+  }
+
+  friend bool operator==(soa_vector const& a, soa_vector const& b) {
+    return a.columns_ == b.columns_;
+  }
+  friend bool operator!=(soa_vector const& a, soa_vector const& b) {
+    return !(a == b);
+  }
+
+  friend void swap(soa_vector& a, soa_vector& b) noexcept {
+    std::swap(a.columns_, b.columns_);
+  }
+};
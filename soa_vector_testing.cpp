@@ -0,0 +1,162 @@
+#include <gtest/gtest.h>
+#include <numeric>
+#include <string>
+#include "counted.h"
+#include "fault_injection.h"
+#include "soa_vector.h"
+
+typedef soa_vector<int, counted> container;
+typedef soa_vector<int, double, std::string> container_record;
+
+TEST(correctness, default_ctor) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    EXPECT_TRUE(c.empty());
+    EXPECT_EQ(0u, c.size());
+    EXPECT_EQ(c.begin(), c.end());
+  });
+}
+
+TEST(correctness, push_back) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    for (int i = 0; i != 100; ++i) c.push_back(i, i * 2);
+    ASSERT_EQ(100u, c.size());
+    container const& cc = c;
+    for (int i = 0; i != 100; ++i) {
+      auto [a, b] = cc[i];
+      EXPECT_EQ(i, a);
+      EXPECT_EQ(i * 2, b);
+    }
+    EXPECT_EQ(99, std::get<0>(cc.back()));
+    EXPECT_EQ(0, std::get<1>(cc.front()));
+  });
+}
+
+TEST(correctness, columns_are_contiguous) {
+  container_record c;
+  for (int i = 0; i != 1000; ++i) c.push_back(i, i * 0.5, std::to_string(i));
+  auto const& ids = c.column<0>();
+  auto const& weights = c.column<1>();
+  ASSERT_EQ(1000u, ids.size());
+  EXPECT_EQ(999 * 1000 / 2, std::accumulate(ids.begin(), ids.end(), 0));
+  EXPECT_EQ(&weights[0] + 999, &weights[999]);
+  EXPECT_EQ("123", c.column<2>()[123]);
+}
+
+TEST(correctness, copy_on_write_per_column) {
+  container_record a;
+  for (int i = 0; i != 100; ++i) a.push_back(i, i * 1.0, "x");
+  container_record b = a;
+  EXPECT_EQ(a, b);
+  EXPECT_EQ(a.column<0>().data(), b.column<0>().data());
+
+  b.field<1>(10) = -1.0;
+  EXPECT_EQ(10.0, a.field<1>(10));
+  EXPECT_EQ(-1.0, std::as_const(b).field<1>(10));
+  EXPECT_NE(a.column<1>().data(), b.column<1>().data());
+  EXPECT_EQ(a.column<0>().data(), b.column<0>().data());
+  EXPECT_EQ(a.column<2>().data(), b.column<2>().data());
+  EXPECT_NE(a, b);
+
+  for (int& id : b.mutable_column<0>()) id = -id;
+  EXPECT_EQ(5, a.field<0>(5));
+  EXPECT_EQ(-5, std::as_const(b).field<0>(5));
+  EXPECT_EQ(a.column<2>().data(), b.column<2>().data());
+}
+
+TEST(correctness, row_references) {
+  container_record c;
+  for (int i = 0; i != 10; ++i) c.push_back(i, 0.0, "");
+  for (auto [id, weight, name] : c) {
+    weight = id * 10.0;
+    name = std::to_string(id);
+  }
+  c[3] = std::make_tuple(30, 1.5, "thirty");
+  container_record const& cc = c;
+  EXPECT_EQ(50.0, std::get<1>(cc[5]));
+  EXPECT_EQ("5", std::get<2>(cc[5]));
+  EXPECT_EQ(30, std::get<0>(cc[3]));
+  EXPECT_EQ("thirty", std::get<2>(cc[3]));
+
+  auto it = cc.begin() + 7;
+  EXPECT_EQ(7, std::get<0>(*it));
+  EXPECT_EQ(8, std::get<0>(it[1]));
+  EXPECT_EQ(3, cc.end() - it);
+  container_record::const_iterator first = c.begin();
+  EXPECT_EQ(cc.begin(), first);
+}
+
+TEST(correctness, pop_back) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    for (int i = 0; i != 20; ++i) c.push_back(i, i);
+    container d = c;
+    while (c.size() > 5) c.pop_back();
+    EXPECT_EQ(5u, c.size());
+    EXPECT_EQ(4, std::get<1>(std::as_const(c).back()));
+    EXPECT_EQ(20u, d.size());
+    EXPECT_EQ(19, std::get<1>(std::as_const(d).back()));
+    c.clear();
+    EXPECT_TRUE(c.empty());
+  });
+}
+
+TEST(correctness, bool_field) {
+  soa_vector<int, bool> c;
+  for (int i = 0; i != 200; ++i) c.push_back(i, i % 3 == 0);
+  EXPECT_EQ(67u, c.column<1>().count());
+  c.field<1>(1) = true;
+  EXPECT_TRUE(std::as_const(c).field<1>(1));
+  EXPECT_EQ(68u, c.column<1>().count());
+
+  soa_vector<int, bool> d = c;
+  for (auto bit : d.mutable_column<1>()) bit.flip();
+  EXPECT_EQ(132u, d.column<1>().count());
+  EXPECT_EQ(68u, c.column<1>().count());
+  EXPECT_FALSE(std::as_const(d).field<1>(0));
+}
+
+TEST(exceptions, push_back_strong_bool) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    // Past one word, so that the bool column is a shared buffer.
+    soa_vector<bool, counted> c;
+    {
+      fault_injection_disable fd;
+      for (int i = 0; i != 100; ++i) c.push_back(i % 2 == 0, i);
+    }
+    soa_vector<bool, counted> d = c;
+    try {
+      c.push_back(false, 100);
+    } catch (...) {
+      EXPECT_EQ(100u, c.column<0>().size());
+      EXPECT_EQ(100u, c.column<1>().size());
+      EXPECT_EQ(c, d);
+      throw;
+    }
+    EXPECT_EQ(101u, c.column<0>().size());
+    EXPECT_EQ(101u, c.column<1>().size());
+  });
+}
+
+TEST(exceptions, push_back_strong) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    for (int i = 0; i != 10; ++i) c.push_back(i, i);
+    container d = c;
+    try {
+      c.push_back(10, 10);
+    } catch (...) {
+      EXPECT_EQ(10u, c.size());
+      EXPECT_EQ(10u, c.column<0>().size());
+      EXPECT_EQ(c, d);
+      throw;
+    }
+    EXPECT_EQ(11u, c.size());
+  });
+}
@@ -1,8 +1,30 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iterator>
 #include <memory>
-#include <variant>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 /**
  * sizeof(vector<T>) <= max(2*sizeof(void*), sizeof(void*) + sizeof(T))
@@ -10,86 +32,832 @@
  * Релизовать все функции который указаны в слаке
  * Гарантии для всех strong, за исключением константных (они noexcept)
  * insert, erase - base гарантии (если вставка/удаление в/до конца, то strong)
- * SmallObject (на 1 объект)
+ * SmallObject (на N объектов, по умолчанию сколько влезает в указатель)
  * CopyOnWrite
  * T не имеет дефолтного конструктора
  * Деструктор Т не кидает исключений, остальное не определено
  */
 
+/**
+ * Types that can be moved to a new address with memcpy, the source then
+ * being treated as destroyed. Trivially copyable types are; specialize
+ * for other types that are (no self-pointers, no address registration).
+ */
+template <typename T>
+struct is_trivially_relocatable : std::is_trivially_copyable<T> {};
+
 template <typename T>
+inline constexpr bool is_trivially_relocatable_v =
+    is_trivially_relocatable<T>::value;
+
+/**
+ * Growth policies. grow() returns the capacity that replaces a full heap
+ * buffer of the given capacity; header_size is the bytes in front of the
+ * elements. Buffers of at least mmap_threshold bytes holding trivially
+ * relocatable elements are mapped directly and grown with mremap, so
+ * growing them moves page tables instead of copying. Copies of at least
+ * parallel_copy_threshold elements (0 for never) are split across threads.
+ * Heap buffers start their elements on a multiple of alignment (and of
+ * alignof(T)), at most a page; inline elements are only aligned for T.
+ */
+struct doubling_growth {
+  static constexpr size_t mmap_threshold = size_t(64) << 20;
+  static constexpr size_t parallel_copy_threshold = 0;
+  static constexpr size_t alignment = 1;
+
+  static size_t grow(size_t capacity, size_t, size_t) noexcept {
+    return capacity * 2;
+  }
+};
+
+struct one_and_half_growth : doubling_growth {
+  static size_t grow(size_t capacity, size_t, size_t) noexcept {
+    return capacity + capacity / 2;
+  }
+};
+
+/** Doubles; elements start on a cache line, for aligned vector loads. */
+struct cache_aligned_growth : doubling_growth {
+  static constexpr size_t alignment = 64;
+};
+
+/** Doubles, then rounds the whole allocation up to a page. */
+struct page_growth : doubling_growth {
+  static constexpr size_t page_size = 4096;
+
+  static size_t grow(size_t capacity, size_t element_size,
+                     size_t header_size) noexcept {
+    size_t bytes = header_size + capacity * 2 * element_size;
+    bytes = (bytes + page_size - 1) / page_size * page_size;
+    return (bytes - header_size) / element_size;
+  }
+};
+
+/**
+ * Counters of the work vectors do behind the scenes, kept only when
+ * VECTOR_STATS is defined (the same way in every translation unit).
+ * of<T>() counts for one element type, global() for all of them.
+ */
+struct vector_stats {
+  std::atomic<size_t> allocations{0};
+  std::atomic<size_t> bytes_copied{0};
+  /** Copies made by data() and everything built on it, like non-const
+   * begin() or operator[], because the buffer was shared.
+   */
+  std::atomic<size_t> detaches{0};
+  std::atomic<size_t> push_back_reallocations{0};
+  std::atomic<size_t> shrinks{0};
+
+  static vector_stats& global() {
+    static vector_stats stats;
+    return stats;
+  }
+  /** Counting never allocates: each type's counters are static. */
+  template <typename T>
+  static vector_stats& of() noexcept;
+
+  void reset() noexcept {
+    allocations = 0;
+    bytes_copied = 0;
+    detaches = 0;
+    push_back_reallocations = 0;
+    shrinks = 0;
+  }
+  void print(FILE* out, char const* name) const {
+    std::fprintf(out,
+                 "%s: allocations %zu, bytes copied %zu, detaches %zu, "
+                 "push_back reallocations %zu, shrinks %zu\n",
+                 name, allocations.load(), bytes_copied.load(),
+                 detaches.load(), push_back_reallocations.load(),
+                 shrinks.load());
+  }
+  /** Prints the global counters, then those of every type seen. */
+  static void dump(FILE* out = stderr);
+  static void dump_at_exit() {
+    static bool registered = std::atexit([] { dump(); }) == 0;
+    (void)registered;
+  }
+
+ private:
+  struct entry;
+
+  static std::atomic<entry*>& entries() {
+    static std::atomic<entry*> head{nullptr};
+    return head;
+  }
+  static bool enroll(entry& e) noexcept;
+};
+
+// Entries are static and trivially destructible, so that dumping at exit
+// is always safe.
+struct vector_stats::entry {
+  char const* name;
+  entry* next;
+  vector_stats stats;
+};
+
+template <typename T>
+vector_stats& vector_stats::of() noexcept {
+  static entry e{typeid(T).name(), nullptr, {}};
+  static bool enrolled = enroll(e);
+  (void)enrolled;
+  return e.stats;
+}
+
+inline void vector_stats::dump(FILE* out) {
+  global().print(out, "all vectors");
+  for (entry* e = entries().load(); e; e = e->next)
+    e->stats.print(out, e->name);
+}
+
+inline bool vector_stats::enroll(entry& e) noexcept {
+  e.next = entries().load();
+  while (!entries().compare_exchange_weak(e.next, &e)) {
+  }
+  return true;
+}
+
+/**
+ * Opt-in reclamation queue. While enabled, heap buffers of at least
+ * threshold bytes (from the default allocator) whose last owner lets go
+ * are destroyed and freed on a background thread instead of the releasing
+ * one. drain() finishes the queued work, for tests and shutdown.
+ */
+class deferred_destruction {
+ public:
+  typedef void (*destroy_fn)(void*) noexcept;
+
+  static void enable(size_t threshold = size_t(1) << 20) {
+    state& s = instance();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (!s.worker.joinable()) {
+      s.stop = false;
+      s.worker = std::thread(&state::run, &s);
+    }
+    threshold_.store(std::max<size_t>(threshold, 1),
+                     std::memory_order_relaxed);
+  }
+  /** Stops deferring and destroys whatever is still queued. */
+  static void disable() {
+    threshold_.store(0, std::memory_order_relaxed);
+    instance().stop_worker();
+    drain();
+  }
+  /** Returns once every buffer queued so far is freed, including those
+   * the background thread has already picked up.
+   */
+  static void drain() {
+    state& s = instance();
+    std::unique_lock<std::mutex> lock(s.mutex);
+    s.run_queued(lock);
+    s.idle.wait(lock, [&s] { return s.pending == 0; });
+  }
+  /** Queues destroy(p) if bytes is over the threshold. Returns false if
+   * the caller has to destroy p itself.
+   */
+  static bool defer(size_t bytes, void* p, destroy_fn destroy) noexcept {
+    size_t threshold = threshold_.load(std::memory_order_relaxed);
+    if (threshold == 0 || bytes < threshold) return false;
+    node* n;
+    try {
+      n = new node{nullptr, p, destroy};
+    } catch (...) {
+      return false;
+    }
+    state& s = instance();
+    {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      n->next = s.head;
+      s.head = n;
+      ++s.pending;
+    }
+    s.ready.notify_one();
+    return true;
+  }
+
+ private:
+  struct node {
+    node* next;
+    void* p;
+    destroy_fn destroy;
+  };
+
+  struct state {
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::condition_variable idle;
+    node* head = nullptr;
+    size_t pending = 0;
+    bool stop = false;
+    std::thread worker;
+
+    ~state() {
+      threshold_.store(0, std::memory_order_relaxed);
+      stop_worker();
+      std::unique_lock<std::mutex> lock(mutex);
+      run_queued(lock);
+    }
+    void stop_worker() {
+      std::thread w;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+        w = std::move(worker);
+      }
+      ready.notify_all();
+      if (w.joinable()) w.join();
+    }
+    /** Destroys the queue with the lock released; destructors may queue
+     * more buffers, hence the loop.
+     */
+    void run_queued(std::unique_lock<std::mutex>& lock) {
+      while (node* n = head) {
+        head = nullptr;
+        lock.unlock();
+        size_t done = 0;
+        for (; n; ++done) {
+          node* next = n->next;
+          n->destroy(n->p);
+          delete n;
+          n = next;
+        }
+        lock.lock();
+        pending -= done;
+      }
+      if (pending == 0) idle.notify_all();
+    }
+    void run() {
+      std::unique_lock<std::mutex> lock(mutex);
+      for (;;) {
+        ready.wait(lock, [this] { return stop || head; });
+        if (stop) return;
+        run_queued(lock);
+      }
+    }
+  };
+
+  static state& instance() {
+    static state s;
+    return s;
+  }
+
+  inline static std::atomic<size_t> threshold_{0};
+};
+
+template <typename T,
+          size_t N = std::max<size_t>(1, sizeof(void*) / sizeof(T)),
+          typename Growth = doubling_growth,
+          typename Allocator = std::allocator<T>>
 class vector {
-  const size_t DEFAULT_VEC_SIZE = 4;
+  static_assert(N > 0, "vector needs room for at least one inline element");
+  static constexpr size_t DEFAULT_VEC_SIZE = 4;
+  static constexpr size_t ALIGNMENT = std::max(alignof(T), Growth::alignment);
+  static_assert((ALIGNMENT & (ALIGNMENT - 1)) == 0 && ALIGNMENT <= 4096,
+                "alignment must be a power of two no larger than a page");
 
-  struct shared_array {
+  struct shared_array;
+  /** Allocation unit, so that allocators that align to the requested type
+   * (like std::pmr ones) hand out memory aligned for shared_array.
+   */
+  struct chunk;
+  using alloc_traits = typename std::allocator_traits<
+      Allocator>::template rebind_traits<chunk>;
+  using chunk_allocator = typename alloc_traits::allocator_type;
+
+  /** The buffer keeps the allocator it came from, since the last owner to
+   * release it may be a copy with a different allocator.
+   */
+  /** The elements follow the header at sizeof(shared_array), which the
+   * alignment rounds up to where they can start; offsetof on a member
+   * of type T would not be valid for every T.
+   */
+  struct alignas(ALIGNMENT) shared_array {
     size_t capacity;
     size_t size;
-    size_t owners;
-    T data[];
+    std::atomic<size_t> owners;
+    [[no_unique_address]] chunk_allocator alloc;
+
+    shared_array(size_t capacity, chunk_allocator const& alloc)
+        : capacity(capacity), size(0), owners(1), alloc(alloc) {}
+
+    T* data() noexcept {
+      return reinterpret_cast<T*>(reinterpret_cast<unsigned char*>(this) +
+                                  sizeof(shared_array));
+    }
 
     bool full() { return size == capacity; }
-    T* end() { return data + size; }
+    /** Acquire pairs with release(): once we see ourselves as the only
+     * owner, every access made through the other owners happened before.
+     */
+    bool shared() { return owners.load(std::memory_order_acquire) > 1; }
+    void acquire() { owners.fetch_add(1, std::memory_order_relaxed); }
+    void release() {
+      size_t was = owners.fetch_sub(1, std::memory_order_release);
+      if ((was & ~FILE_BACKED) == 1) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        destroy();
+      }
+    }
+    T* end() { return data() + size; }
     void destroy() {
-      std::destroy_n(data, size);
-      operator delete(this);
+      // Custom allocators, like pmr arenas, are rarely thread-safe.
+      if constexpr (std::is_same_v<Allocator, std::allocator<T>>) {
+        if (deferred_destruction::defer(
+                bytes(capacity), this, [](void* p) noexcept {
+                  static_cast<shared_array*>(p)->destroy_now();
+                })) {
+          return;
+        }
+      }
+      destroy_now();
     }
+    void destroy_now() {
+      if (owners.load(std::memory_order_relaxed) & FILE_BACKED)
+        return unmap_file(this);
+      std::destroy_n(data(), size);
+      deallocate(this);
+    }
+  };
+
+  struct alignas(shared_array) chunk {
+    unsigned char bytes[alignof(shared_array)];
+  };
+
+  static constexpr size_t HEAP = 1;
+  /** Set in owners of a buffer mapped from a file by load(): it counts as
+   * shared forever, so the first write copies it out.
+   */
+  static constexpr size_t FILE_BACKED = ~(~size_t(0) >> 1);
+
+  /** Start of a file written by save(); the buffer image follows it,
+   * as aligned in memory.
+   */
+  struct alignas(std::max<size_t>(64, ALIGNMENT)) file_header {
+    char magic[8];
+    uint64_t type_hash;
+    uint64_t element_size;
+    uint64_t size;
+    uint64_t capacity;
+    uint64_t data_offset;
   };
 
+  /** FNV-1a of the type name, so that it is the same in every process. */
+  static uint64_t type_hash() noexcept {
+    uint64_t h = 14695981039346656037ull;
+    for (char const* c = typeid(T).name(); *c; ++c)
+      h = (h ^ static_cast<unsigned char>(*c)) * 1099511628211ull;
+    return h;
+  }
+  static bool write_all(int fd, void const* src, size_t count) noexcept {
+    auto p = static_cast<char const*>(src);
+    while (count) {
+      ssize_t n = write(fd, p, count);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      p += n;
+      count -= n;
+    }
+    return true;
+  }
+  static void unmap_file(shared_array* a) noexcept {
+    munmap(reinterpret_cast<char*>(a) - sizeof(file_header),
+           sizeof(file_header) + bytes(a->capacity));
+  }
+
   /** Invariant:
-   * data_.index() == 0 -> u_ == std::monostate
-   * data_.index() == 1 -> u_ == T
-   * data_.index() == 2 -> u_ == shared_array*
+   * tag_ == size << 1 | on_heap
+   * tag_ & HEAP -> heap_ is the data of a shared_array, maybe shared
+   * otherwise   -> the elements live inline in storage_, at most N of them
+   */
+  size_t tag_;
+  union {
+    T* heap_;
+    alignas(T) unsigned char storage_[N * sizeof(T)];
+  };
+  [[no_unique_address]] Allocator alloc_;
+
+  bool on_heap() const noexcept { return tag_ & HEAP; }
+  shared_array* array() const noexcept {
+    return reinterpret_cast<shared_array*>(
+        reinterpret_cast<unsigned char*>(heap_) - sizeof(shared_array));
+  }
+  T* inline_data() noexcept {
+    return std::launder(reinterpret_cast<T*>(storage_));
+  }
+  T const* inline_data() const noexcept {
+    return std::launder(reinterpret_cast<T const*>(storage_));
+  }
+  /** Sets the size of the current storage, keeping the heap copy in sync. */
+  void set_size(size_t n) noexcept {
+    if (on_heap()) array()->size = n;
+    tag_ = n << 1 | (tag_ & HEAP);
+  }
+
+  static size_t bytes(size_t capacity) noexcept {
+    return sizeof(shared_array) + capacity * sizeof(T);
+  }
+  static size_t chunks(size_t capacity) noexcept {
+    return (bytes(capacity) + sizeof(chunk) - 1) / sizeof(chunk);
+  }
+  /** Whether a buffer of this capacity lives in its own mapping. Custom
+   * allocators get every buffer, however big.
+   */
+  static bool mapped(size_t capacity) noexcept {
+    if constexpr (is_trivially_relocatable_v<T> &&
+                  std::is_same_v<Allocator, std::allocator<T>>) {
+      return bytes(capacity) >= Growth::mmap_threshold;
+    } else {
+      return false;
+    }
+  }
+  shared_array* new_shared(size_t capacity) const {
+    return new_shared(capacity, chunk_allocator(alloc_));
+  }
+  static void count(std::atomic<size_t> vector_stats::*field,
+                    size_t n = 1) noexcept {
+#ifdef VECTOR_STATS
+    (vector_stats::of<T>().*field).fetch_add(n, std::memory_order_relaxed);
+    (vector_stats::global().*field).fetch_add(n, std::memory_order_relaxed);
+#else
+    (void)field;
+    (void)n;
+#endif
+  }
+
+  static shared_array* new_shared(size_t capacity, chunk_allocator alloc) {
+    count(&vector_stats::allocations);
+    void* mem;
+    if (mapped(capacity)) {
+      mem = mmap(nullptr, bytes(capacity), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (mem == MAP_FAILED) throw std::bad_alloc();
+    } else {
+      mem = alloc_traits::allocate(alloc, chunks(capacity));
+    }
+    return new (mem) shared_array(capacity, alloc);
+  }
+  static void deallocate(shared_array* a) noexcept {
+    size_t capacity = a->capacity;
+    if (mapped(capacity)) {
+      munmap(a, bytes(capacity));
+      return;
+    }
+    // Only the allocator needs destroying; the elements are gone already.
+    chunk_allocator alloc(std::move(a->alloc));
+    a->alloc.~chunk_allocator();
+    alloc_traits::deallocate(alloc, reinterpret_cast<chunk*>(a),
+                             chunks(capacity));
+  }
+  bool can_remap(size_t new_capacity) const noexcept {
+#ifdef __linux__
+    return on_heap() && mapped(array()->capacity) && mapped(new_capacity) &&
+           !array()->shared();
+#else
+    return false;
+#endif
+  }
+  /** Grows a mapped buffer, moving its pages if it can't grow in place. */
+  void remap(size_t new_capacity) {
+#ifdef __linux__
+    shared_array* a = array();
+    void* mem = mremap(a, bytes(a->capacity), bytes(new_capacity),
+                       MREMAP_MAYMOVE);
+    if (mem == MAP_FAILED) throw std::bad_alloc();
+    a = static_cast<shared_array*>(mem);
+    a->capacity = new_capacity;
+    heap_ = a->data();
+#endif
+  }
+
+  static void copy_construct(T const* src, size_t count, T* dst) {
+    vector::count(&vector_stats::bytes_copied, count * sizeof(T));
+    if (Growth::parallel_copy_threshold != 0 &&
+        count >= Growth::parallel_copy_threshold) {
+      return parallel_copy(src, count, dst);
+    }
+    if constexpr (std::is_trivially_copyable_v<T>) {
+      if (count) std::memcpy(static_cast<void*>(dst), src, count * sizeof(T));
+    } else {
+      std::uninitialized_copy_n(src, count, dst);
+    }
+  }
+  /** copy_construct() in one chunk per hardware thread. If any chunk
+   * throws, the chunks that were copied are destroyed before rethrowing.
    */
-  std::variant<std::monostate, T, shared_array*> data_;
+  static void parallel_copy(T const* src, size_t count, T* dst) {
+    size_t parts = std::max(1u, std::thread::hardware_concurrency());
+    size_t chunk = (count + parts - 1) / parts;
+    parts = (count + chunk - 1) / chunk;
+    std::unique_ptr<std::exception_ptr[]> errors(
+        new std::exception_ptr[parts]);
+    std::unique_ptr<std::thread[]> workers(new std::thread[parts]);
+    auto run = [&](size_t i) {
+      size_t first = i * chunk;
+      size_t n = std::min(chunk, count - first);
+      try {
+        if constexpr (std::is_trivially_copyable_v<T>) {
+          std::memcpy(static_cast<void*>(dst + first), src + first,
+                      n * sizeof(T));
+        } else {
+          std::uninitialized_copy_n(src + first, n, dst + first);
+        }
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    };
+    for (size_t i = 1; i != parts; ++i) {
+      try {
+        workers[i] = std::thread(run, i);
+      } catch (...) {
+        run(i);
+      }
+    }
+    run(0);
+    for (size_t i = 1; i != parts; ++i) {
+      if (workers[i].joinable()) workers[i].join();
+    }
+    for (size_t i = 0; i != parts; ++i) {
+      if (!errors[i]) continue;
+      for (size_t j = 0; j != parts; ++j) {
+        size_t first = j * chunk;
+        if (!errors[j])
+          std::destroy_n(dst + first, std::min(chunk, count - first));
+      }
+      std::rethrow_exception(errors[i]);
+    }
+  }
+  /** Only for trivially relocatable T: src is left destroyed. */
+  static void relocate(T* src, size_t count, T* dst) noexcept {
+    if (count)
+      std::memmove(static_cast<void*>(dst), static_cast<void*>(src),
+                   count * sizeof(T));
+  }
 
-  shared_array* new_shared(size_t capacity) {
-    auto mem = operator new(sizeof(shared_array) + capacity * sizeof(T));
+  /** Constructs the first count elements of this vector at dst.
+   * Elements are relocated or moved when this vector is their only owner
+   * and that can't throw, otherwise copied. Returns the number constructed.
+   * A relocated buffer is left empty, so call this only at the point where
+   * nothing else can throw before the new buffer is installed.
+   */
+  size_t transfer(T* dst, size_t count) {
+    T* src = on_heap() ? heap_ : inline_data();
+    size_t src_size = size();
+    count = std::min(count, src_size);
+    if (!on_heap() || !array()->shared()) {
+      if constexpr (is_trivially_relocatable_v<T>) {
+        relocate(src, count, dst);
+        std::destroy(src + count, src + src_size);
+        set_size(0);
+        return count;
+      } else if constexpr (std::is_nothrow_move_constructible_v<T>) {
+        std::uninitialized_move_n(src, count, dst);
+        return count;
+      }
+    }
+    copy_construct(src, count, dst);
+    return count;
+  }
+  /** Like transfer() of all elements, but leaves a gap of k at index i. */
+  void transfer_around(T* dst, size_t i, size_t k) {
+    T* src = on_heap() ? heap_ : inline_data();
+    size_t n = size();
+    if (!on_heap() || !array()->shared()) {
+      if constexpr (is_trivially_relocatable_v<T>) {
+        relocate(src, i, dst);
+        relocate(src + i, n - i, dst + i + k);
+        set_size(0);
+        return;
+      } else if constexpr (std::is_nothrow_move_constructible_v<T>) {
+        std::uninitialized_move_n(src, i, dst);
+        std::uninitialized_move_n(src + i, n - i, dst + i + k);
+        return;
+      }
+    }
+    copy_construct(src, i, dst);
     try {
-      new (mem) shared_array{capacity, 0, 1};
+      copy_construct(src + i, n - i, dst + i + k);
     } catch (...) {
-      operator delete(mem);
+      std::destroy_n(dst, i);
       throw;
     }
-    shared_array* n = reinterpret_cast<shared_array*>(mem);
-    return n;
   }
-  shared_array* resize_vector(size_t capacity) {
+  static size_t grow(size_t capacity) noexcept {
+    size_t next = Growth::grow(capacity, sizeof(T), bytes(0));
+    return std::max({DEFAULT_VEC_SIZE, capacity + 1, next});
+  }
+  size_t next_capacity() const noexcept {
+    if (!on_heap()) return grow(N);
+    shared_array* a = array();
+    return a->full() ? grow(a->capacity) : a->capacity;
+  }
+  shared_array* resize_vector(size_t capacity, size_t count = SIZE_MAX) {
     shared_array* n = new_shared(capacity);
-    if (data_.index() == 1) {
-      n->size = 1;
+    try {
+      n->size = transfer(n->data(), std::min(capacity, count));
+    } catch (...) {
+      deallocate(n);
+      throw;
+    }
+    return n;
+  }
+  /** Drops the current storage: releases the heap buffer or destroys the
+   * inline elements. Leaves tag_ for the caller to set.
+   */
+  void drop() noexcept {
+    if (on_heap()) {
+      array()->release();
+    } else {
+      std::destroy_n(inline_data(), size());
+    }
+  }
+  void set_data(shared_array* n) {
+    if (!on_heap() || n != array()) drop();
+    heap_ = n->data();
+    tag_ = n->size << 1 | HEAP;
+  }
+  /** Leaves the heap buffer for inline storage. fill(old, dst) constructs
+   * the new contents at dst from the old buffer and returns their count,
+   * cleaning up after itself if it throws.
+   */
+  template <typename Fill>
+  void to_inline(Fill fill) {
+    shared_array* a = array();
+    tag_ = 0;
+    try {
+      tag_ = fill(a, inline_data()) << 1;
+    } catch (...) {
+      heap_ = a->data();
+      tag_ = a->size << 1 | HEAP;
+      throw;
+    }
+    a->release();
+  }
+
+  /** Removes data[i, j) from data[0, size) in place. */
+  static void erase_in_place(T* data, size_t size, size_t i, size_t j) {
+    if constexpr (is_trivially_relocatable_v<T>) {
+      std::destroy(data + i, data + j);
+      relocate(data + j, size - j, data + i);
+    } else {
+      std::move(data + j, data + size, data + i);
+      std::destroy(data + size - (j - i), data + size);
+    }
+  }
+
+  /** Inserts count elements at index i. fill(dst, count) constructs them,
+   * cleaning up after itself if it throws. A buffer this vector owns with
+   * room to spare is shifted in place; otherwise the new buffer is built
+   * as prefix, new elements, suffix with a single allocation.
+   */
+  template <typename Fill>
+  void insert_with(size_t i, size_t count, Fill fill) {
+    if (count == 0) return;
+    size_t n = size();
+    size_t total = n + count;
+    size_t cap = capacity();
+    if (total > cap) {
+      cap = std::max(total, grow(cap));
+      if (can_remap(cap)) remap(cap);
+    }
+    if ((!on_heap() || !array()->shared()) && total <= capacity()) {
+      T* p = on_heap() ? heap_ : inline_data();
+      if constexpr (is_trivially_relocatable_v<T>) {
+        relocate(p + i, n - i, p + i + count);
+        try {
+          fill(p + i, count);
+        } catch (...) {
+          relocate(p + i + count, n - i, p + i);
+          throw;
+        }
+        set_size(total);
+      } else {
+        fill(p + n, count);
+        // Count the new elements first: a throwing assignment in the
+        // rotate leaves them out of order, but owned and alive.
+        set_size(total);
+        std::rotate(p + i, p + n, p + total);
+      }
+    } else if (total <= N) {
+      to_inline([&](shared_array* old, T* dst) {
+        fill(dst + i, count);
+        try {
+          copy_construct(old->data(), i, dst);
+        } catch (...) {
+          std::destroy_n(dst + i, count);
+          throw;
+        }
+        try {
+          copy_construct(old->data() + i, n - i, dst + i + count);
+        } catch (...) {
+          std::destroy_n(dst, i + count);
+          throw;
+        }
+        return total;
+      });
+    } else {
+      shared_array* t = new_shared(cap);
       try {
-        new (n->data) T(std::get<1>(data_));
+        fill(t->data() + i, count);
       } catch (...) {
-        operator delete(n);
+        deallocate(t);
         throw;
       }
-    } else if (data_.index() == 2) {
-      n->size = std::min(n->capacity, std::get<2>(data_)->size);
       try {
-        std::uninitialized_copy_n(std::get<2>(data_)->data, n->size, n->data);
+        transfer_around(t->data(), i, count);
       } catch (...) {
-        operator delete(n);
+        std::destroy_n(t->data() + i, count);
+        deallocate(t);
         throw;
       }
+      t->size = total;
+      set_data(t);
     }
-    return n;
   }
-  void set_data(shared_array* n) {
-    if (data_.index() == 2 && n != std::get<2>(data_)) {
-      std::get<2>(data_)->owners--;
-      if (std::get<2>(data_)->owners == 0) std::get<2>(data_)->destroy();
+
+  template <typename It>
+  using require_input_iterator = std::enable_if_t<std::is_convertible_v<
+      typename std::iterator_traits<It>::iterator_category,
+      std::input_iterator_tag>>;
+
+  /** Forward ranges are measured and copied into one exact allocation. */
+  template <typename ForwardIterator>
+  void construct_from(ForwardIterator first, ForwardIterator last,
+                      std::forward_iterator_tag) {
+    size_t size = std::distance(first, last);
+    T* dst = inline_data();
+    shared_array* t = nullptr;
+    if (size > N) {
+      t = new_shared(size);
+      dst = t->data();
+    }
+    try {
+      std::uninitialized_copy(first, last, dst);
+    } catch (...) {
+      if (t) deallocate(t);
+      throw;
     }
-    data_ = n;
+    if (t) {
+      t->size = size;
+      set_data(t);
+    } else {
+      tag_ = size << 1;
+    }
+  }
+  /** Single-pass ranges can be read only once, so they grow as they go. */
+  template <typename InputIterator>
+  void construct_from(InputIterator first, InputIterator last,
+                      std::input_iterator_tag) {
+    for (; first != last; ++first) emplace_back(*first);
   }
-  void set_data(T const& v) {
-    if (data_.index() == 2) {
-      std::get<2>(data_)->owners--;
-      if (std::get<2>(data_)->owners == 0) std::get<2>(data_)->destroy();
+
+  template <typename Fill>
+  void resize_with(size_t new_size, Fill fill) {
+    size_t n = size();
+    if (n == new_size) return;
+    size_t k = std::min(n, new_size);
+    if (new_size > capacity() && can_remap(new_size)) remap(new_size);
+    if ((!on_heap() || !array()->shared()) && new_size <= capacity()) {
+      T* p = on_heap() ? heap_ : inline_data();
+      if (new_size < n) {
+        std::destroy(p + new_size, p + n);
+      } else {
+        fill(p + n, new_size - n);
+      }
+      set_size(new_size);
+    } else if (new_size > N) {
+      shared_array* t = new_shared(new_size);
+      try {
+        fill(t->data() + k, new_size - k);
+      } catch (...) {
+        deallocate(t);
+        throw;
+      }
+      try {
+        transfer(t->data(), k);
+      } catch (...) {
+        std::destroy(t->data() + k, t->data() + new_size);
+        deallocate(t);
+        throw;
+      }
+      t->size = new_size;
+      set_data(t);
+    } else {
+      to_inline([&](shared_array* old, T* dst) {
+        fill(dst + k, new_size - k);
+        try {
+          copy_construct(old->data(), k, dst);
+        } catch (...) {
+          std::destroy(dst + k, dst + new_size);
+          throw;
+        }
+        return new_size;
+      });
     }
-    data_ = v;
   }
 
  public:
   typedef T value_type;
+  typedef Allocator allocator_type;
   typedef T const& const_reference;
   typedef T& reference;
   typedef T const* const_pointer;
@@ -100,42 +868,137 @@ class vector {
   typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
   typedef std::reverse_iterator<iterator> reverse_iterator;
 
-  vector() noexcept : data_(std::monostate()) {}
-  ~vector() { clear(); }
+  /** Writable view of the elements, taken after detaching once. */
+  struct span {
+    pointer ptr;
+    size_t count;
 
-  bool empty() const noexcept { return data_.index() == 0; };
-  size_t size() const noexcept {
-    return data_.index() == 2 ? std::get<2>(data_)->size : data_.index();
-  }
+    pointer data() const noexcept { return ptr; }
+    size_t size() const noexcept { return count; }
+    pointer begin() const noexcept { return ptr; }
+    pointer end() const noexcept { return ptr + count; }
+    reference operator[](size_t index) const noexcept { return ptr[index]; }
+  };
+
+  /** Window into a vector's heap buffer, holding a reference to it.
+   * Writing through a slice whose buffer is shared copies the window out
+   * first, the same way a vector detaches.
+   */
+  class slice_type {
+   public:
+    slice_type() noexcept : array_(nullptr), first_(nullptr), size_(0) {}
+    slice_type(slice_type const& other) noexcept
+        : array_(other.array_), first_(other.first_), size_(other.size_) {
+      if (array_) array_->acquire();
+    }
+    slice_type(slice_type&& other) noexcept : slice_type() {
+      swap(*this, other);
+    }
+    slice_type& operator=(slice_type other) noexcept {
+      swap(*this, other);
+      return *this;
+    }
+    ~slice_type() {
+      if (array_) array_->release();
+    }
+
+    bool empty() const noexcept { return size_ == 0; }
+    size_t size() const noexcept { return size_; }
+
+    const_pointer data() const noexcept { return first_; }
+    pointer data() {
+      if (array_ && array_->shared()) {
+        count(&vector_stats::detaches);
+        detach();
+      }
+      return first_;
+    }
+    const_reference operator[](size_t index) const noexcept {
+      return first_[index];
+    }
+    reference operator[](size_t index) { return data()[index]; }
+    const_reference front() const noexcept { return first_[0]; }
+    const_reference back() const noexcept { return first_[size_ - 1]; }
+
+    const_iterator begin() const noexcept { return first_; }
+    const_iterator end() const noexcept { return first_ + size_; }
+    iterator begin() { return data(); }
+    iterator end() { return data() + size_; }
+
+    slice_type slice(const_iterator first, const_iterator last) const {
+      if (first == last) return slice_type();
+      array_->acquire();
+      return slice_type(array_, first, last - first);
+    }
+
+    friend void swap(slice_type& a, slice_type& b) noexcept {
+      std::swap(a.array_, b.array_);
+      std::swap(a.first_, b.first_);
+      std::swap(a.size_, b.size_);
+    }
+
+   private:
+    friend class vector;
+
+    slice_type(shared_array* a, T const* first, size_t size) noexcept
+        : array_(a), first_(const_cast<T*>(first)), size_(size) {}
+
+    void detach() {
+      shared_array* t = new_shared(size_, array_->alloc);
+      try {
+        copy_construct(first_, size_, t->data());
+      } catch (...) {
+        deallocate(t);
+        throw;
+      }
+      t->size = size_;
+      array_->release();
+      array_ = t;
+      first_ = t->data();
+    }
+
+    shared_array* array_;
+    T* first_;
+    size_t size_;
+  };
+
+  vector() noexcept(noexcept(Allocator())) : vector(Allocator()) {}
+  /** The allocator only supplies heap buffers; inline elements and the
+   * elements themselves are constructed directly.
+   */
+  explicit vector(Allocator const& alloc) noexcept
+      : tag_(0), heap_(nullptr), alloc_(alloc) {}
+  ~vector() { drop(); }
+
+  allocator_type get_allocator() const noexcept { return alloc_; }
+
+  bool empty() const noexcept { return size() == 0; };
+  size_t size() const noexcept { return tag_ >> 1; }
   size_t capacity() const noexcept {
-    return data_.index() == 2 ? std::get<2>(data_)->capacity : 1;
+    return on_heap() ? array()->capacity : N;
   }
   void clear() {
-    if (data_.index() == 2) {
-      std::get<2>(data_)->owners--;
-      if (std::get<2>(data_)->owners == 0) std::get<2>(data_)->destroy();
-    }
-    data_ = std::monostate();
+    drop();
+    tag_ = 0;
   }
 
   const_pointer data() const noexcept {
-    if (data_.index() == 2) {
-      return std::get<2>(data_)->data;
-    } else if (data_.index() == 1) {
-      return &std::get<1>(data_);
-    }
-    return nullptr;
+    // Masked select instead of a branch: this sits in the innermost loop
+    // of scans. heap_ is read as raw bytes since it may be inactive.
+    uintptr_t heap, mask = -(tag_ & HEAP);
+    std::memcpy(&heap, &heap_, sizeof(heap));
+    return reinterpret_cast<T const*>(
+        (heap & mask) |
+        (reinterpret_cast<uintptr_t>(inline_data()) & ~mask));
   }
 
   pointer data() {
-    if (data_.index() == 2) {
-      if (std::get<2>(data_)->owners > 1)
-        set_data(resize_vector(std::get<2>(data_)->size));
-      return std::get<2>(data_)->data;
-    } else if (data_.index() == 1) {
-      return &std::get<1>(data_);
+    if (!on_heap()) return inline_data();
+    if (array()->shared()) {
+      count(&vector_stats::detaches);
+      set_data(resize_vector(size()));
     }
-    return nullptr;
+    return heap_;
   }
 
   const_reference operator[](size_t index) const noexcept {
@@ -162,211 +1025,899 @@ class vector {
   reverse_iterator rbegin() noexcept { return reverse_iterator(end()); }
   reverse_iterator rend() noexcept { return reverse_iterator(begin()); }
 
-  vector(vector const& other) noexcept : data_(std::monostate()) {
-    data_ = other.data_;
-    if (data_.index() == 2) {
-      std::get<2>(data_)->owners++;
+  const_iterator cbegin() const noexcept { return begin(); }
+  const_iterator cend() const noexcept { return end(); }
+  const_reverse_iterator crbegin() const noexcept { return rbegin(); }
+  const_reverse_iterator crend() const noexcept { return rend(); }
+
+  /** Copies the elements if the buffer is shared, so that the pointer
+   * returned here and from data() stays writable without further checks
+   * until this vector is copied, reallocated or changes size.
+   */
+  pointer unshare() { return data(); }
+  span mutable_span() { return span{unshare(), size()}; }
+
+  vector(vector const& other) noexcept(
+      std::is_nothrow_copy_constructible_v<T>)
+      : tag_(0),
+        heap_(nullptr),
+        alloc_(std::allocator_traits<Allocator>::
+                   select_on_container_copy_construction(other.alloc_)) {
+    if (other.on_heap()) {
+      heap_ = other.heap_;
+      array()->acquire();
+    } else {
+      copy_construct(other.inline_data(), other.size(), inline_data());
+    }
+    tag_ = other.tag_;
+  }
+  vector(vector&& other) noexcept(std::is_nothrow_move_constructible_v<T>)
+      : tag_(0), heap_(nullptr), alloc_(std::move(other.alloc_)) {
+    if (other.on_heap()) {
+      heap_ = other.heap_;
+    } else if constexpr (is_trivially_relocatable_v<T>) {
+      relocate(other.inline_data(), other.size(), inline_data());
+    } else {
+      std::uninitialized_move_n(other.inline_data(), other.size(),
+                                inline_data());
+      other.drop();
     }
+    tag_ = other.tag_;
+    other.tag_ = 0;
   }
+  // Buffers free themselves through their own allocator, so a buffer can
+  // be shared or stolen whatever the propagation traits say; they only
+  // decide which allocator the next buffer comes from.
   vector& operator=(vector const& other) {
     vector temp(other);
     swap(*this, temp);
+    if constexpr (std::allocator_traits<Allocator>::
+                      propagate_on_container_copy_assignment::value) {
+      alloc_ = other.alloc_;
+    }
     return *this;
   }
-
-  template <typename InputIterator>
-  vector(InputIterator first, InputIterator last) : data_(std::monostate()) {
-    size_t size = std::distance(first, last);
-    if (size > 1) {
-      shared_array* t = new_shared(size);
-      try {
-        std::uninitialized_copy(first, last, t->data);
-        t->size = size;
-      } catch (...) {
-        operator delete(t);
+  vector& operator=(vector&& other) noexcept(
+      std::is_nothrow_move_constructible_v<T>) {
+    if (this != &other) {
+      clear();
+      if constexpr (std::allocator_traits<Allocator>::
+                        propagate_on_container_move_assignment::value) {
+        alloc_ = std::move(other.alloc_);
       }
-      data_ = t;
-    } else if (size == 1) {
-      data_ = *first;
+      if (other.on_heap()) {
+        heap_ = other.heap_;
+        tag_ = other.tag_;
+        other.tag_ = 0;
+      } else {
+        tag_ = other.transfer(inline_data(), N) << 1;
+        other.clear();
+      }
+    }
+    return *this;
+  }
+
+  vector(size_t count, const_reference value,
+         Allocator const& alloc = Allocator())
+      : vector(alloc) {
+    T* dst = inline_data();
+    shared_array* t = nullptr;
+    if (count > N) {
+      t = new_shared(count);
+      dst = t->data();
+    }
+    try {
+      std::uninitialized_fill_n(dst, count, value);
+    } catch (...) {
+      if (t) deallocate(t);
+      throw;
+    }
+    if (t) {
+      t->size = count;
+      set_data(t);
     } else {
-      data_ = std::monostate();
+      tag_ = count << 1;
     }
   }
-  template <typename InputIterator>
+  template <typename InputIterator,
+            typename = require_input_iterator<InputIterator>>
+  vector(InputIterator first, InputIterator last,
+         Allocator const& alloc = Allocator())
+      : vector(alloc) {
+    construct_from(
+        first, last,
+        typename std::iterator_traits<InputIterator>::iterator_category());
+  }
+  template <typename InputIterator,
+            typename = require_input_iterator<InputIterator>>
   void assign(InputIterator first, InputIterator last) {
-    vector temp(first, last);
-    std::swap(*this, temp);
+    vector temp(first, last, alloc_);
+    swap(*this, temp);
   }
 
-  void push_back(const_reference v) {
-    if (data_.index() == 0) {
-      data_ = v;
-    } else {
-      shared_array* na;
-      if (data_.index() == 2) {
-        na = resize_vector(std::get<2>(data_)->capacity *
-                           (std::get<2>(data_)->full() ? 2 : 1));
-      } else {
-        na = resize_vector(DEFAULT_VEC_SIZE);
+  void push_back(const_reference v) { emplace_back(v); }
+  void push_back(T&& v) { emplace_back(std::move(v)); }
+
+  template <typename... Args>
+  reference emplace_back(Args&&... args) {
+    size_t n = size();
+    if (!on_heap()) {
+      if (n < N) {
+        new (inline_data() + n) T(std::forward<Args>(args)...);
+        tag_ += 2;
+        return inline_data()[n];
       }
-      try {
-        new (na->end()) T(v);
-      } catch (...) {
-        operator delete(na);
-        throw;
+    } else if (!array()->shared() && !array()->full()) {
+      new (heap_ + n) T(std::forward<Args>(args)...);
+      set_size(n + 1);
+      return heap_[n];
+    }
+    if constexpr (is_trivially_relocatable_v<T>) {
+      if (can_remap(next_capacity())) {
+        count(&vector_stats::push_back_reallocations);
+        // args may refer into the mapping that is about to move.
+        alignas(T) unsigned char tmp[sizeof(T)];
+        T* v = new (tmp) T(std::forward<Args>(args)...);
+        try {
+          remap(next_capacity());
+        } catch (...) {
+          v->~T();
+          throw;
+        }
+        relocate(v, 1, heap_ + n);
+        set_size(n + 1);
+        return heap_[n];
       }
-      na->size++;
-      set_data(na);
     }
+    // The new element goes in first: args may refer into the old buffer,
+    // and the old elements must stay intact until nothing else can throw.
+    count(&vector_stats::push_back_reallocations);
+    shared_array* na = new_shared(next_capacity());
+    try {
+      new (na->data() + n) T(std::forward<Args>(args)...);
+    } catch (...) {
+      deallocate(na);
+      throw;
+    }
+    try {
+      transfer(na->data(), n);
+    } catch (...) {
+      na->data()[n].~T();
+      deallocate(na);
+      throw;
+    }
+    na->size = n + 1;
+    set_data(na);
+    return na->data()[n];
   }
 
   void pop_back() {
-    if (data_.index() == 2) {
-      if (std::get<2>(data_)->size == 2) {
-        T v = std::get<2>(data_)->data[0];
-        set_data(v);
-      } else {
-        shared_array* t = resize_vector(std::get<2>(data_)->capacity);
-        t->data[--t->size].~T();
-        set_data(t);
-      }
-    } else if (data_.index() == 1) {
-      data_ = std::monostate();
+    if (empty()) return;
+    size_t n = size() - 1;
+    if (!on_heap() || !array()->shared()) {
+      data()[n].~T();
+      set_size(n);
+    } else if (n <= N) {
+      to_inline([n](shared_array* old, T* dst) {
+        copy_construct(old->data(), n, dst);
+        return n;
+      });
+    } else {
+      set_data(resize_vector(array()->capacity, n));
     }
   }
 
   void shrink_to_fit() {
-    if (data_.index() == 2 && !std::get<2>(data_)->full()) {
-      set_data(resize_vector(std::get<2>(data_)->size));
+    if (on_heap() && !array()->full()) {
+      count(&vector_stats::shrinks);
+      set_data(resize_vector(size()));
     }
   }
 
   void resize(size_t new_size) {
-    if (size() == new_size) return;
-    shared_array* t;
-    if (new_size > 1) {
-      t = resize_vector(new_size);
-      try {
-        std::uninitialized_value_construct_n(t->end(), new_size - t->size);
-      } catch (...) {
-        operator delete(t);
-        throw;
-      }
-      t->size = new_size;
-      set_data(t);
-    } else if (new_size == 1) {
-      if (data_.index() == 2) {
-        T v = std::get<2>(data_)->data[0];
-        set_data(v);
-      } else {
-        data_ = T();
-      }
-    } else {
-      clear();
-    }
+    resize_with(new_size, [](T* dst, size_t count) {
+      std::uninitialized_value_construct_n(dst, count);
+    });
   }
   void resize(size_t new_size, const_reference default_value) {
-    if (size() == new_size) return;
-    shared_array* t;
-    if (new_size > 1) {
-      t = resize_vector(new_size);
-      try {
-        std::uninitialized_fill_n(t->end(), new_size - t->size, default_value);
-      } catch (...) {
-        operator delete(t);
-        throw;
-      }
-      t->size = new_size;
-      set_data(t);
-    } else if (new_size == 1) {
-      if (data_.index() == 2) {
-        T v = std::get<2>(data_)->data[0];
-        set_data(v);
-      } else {
-        data_ = T(default_value);
-      }
-    } else {
-      clear();
+    if (new_size <= size()) {
+      resize_with(new_size, [](T*, size_t) {});
+      return;
     }
+    T copy(default_value);  // may be an element that a remap is about to move
+    resize_with(new_size, [&copy](T* dst, size_t count) {
+      std::uninitialized_fill_n(dst, count, copy);
+    });
+  }
+  /** Like resize(), but new elements are default-initialized, which for
+   * trivial types means left as they are: for buffers about to be filled
+   * from I/O or a decoder.
+   */
+  void resize_for_overwrite(size_t new_size) {
+    static_assert(std::is_trivially_default_constructible_v<T>,
+                  "resize_for_overwrite needs a trivial default constructor");
+    resize_with(new_size, [](T* dst, size_t count) {
+      std::uninitialized_default_construct_n(dst, count);
+    });
   }
   void reserve(size_t new_capacity) {
-    if (size() >= new_capacity || new_capacity < 2) return;
+    if (capacity() >= new_capacity) return;
+    if (can_remap(new_capacity)) return remap(new_capacity);
     set_data(resize_vector(new_capacity));
   }
 
+  /** Shares the heap buffer in O(1); inline elements are copied out. */
+  slice_type slice(const_iterator first, const_iterator last) const {
+    size_t count = last - first;
+    if (count == 0) return slice_type();
+    if (on_heap()) {
+      array()->acquire();
+      return slice_type(array(), first, count);
+    }
+    shared_array* t = new_shared(count);
+    try {
+      copy_construct(first, count, t->data());
+    } catch (...) {
+      deallocate(t);
+      throw;
+    }
+    t->size = count;
+    return slice_type(t, t->data(), count);
+  }
+
   iterator insert(const_iterator pos, const_reference val) {
-    size_t i = pos ? pos - begin() : 0;
-    push_back(val);
-    if (data_.index() == 2) {
-      std::rotate(begin() + i, end() - 1, end());
+    return emplace(pos, val);
+  }
+  iterator insert(const_iterator pos, T&& val) {
+    return emplace(pos, std::move(val));
+  }
+  iterator insert(const_iterator pos, size_t count, const_reference val) {
+    size_t i = pos - std::as_const(*this).begin();
+    if (count) {
+      T copy(val);  // val may be an element that is about to move
+      insert_with(i, count, [&copy](T* dst, size_t k) {
+        std::uninitialized_fill_n(dst, k, copy);
+      });
+    }
+    return begin() + i;
+  }
+  template <typename InputIterator,
+            typename = require_input_iterator<InputIterator>>
+  iterator insert(const_iterator pos, InputIterator first,
+                  InputIterator last) {
+    size_t i = pos - std::as_const(*this).begin();
+    if constexpr (std::is_convertible_v<typename std::iterator_traits<
+                                            InputIterator>::iterator_category,
+                                        std::forward_iterator_tag>) {
+      size_t count = std::distance(first, last);
+      insert_with(i, count, [&first](T* dst, size_t k) {
+        std::uninitialized_copy_n(first, k, dst);
+      });
+    } else {
+      // Single pass: collect first, so that the shift happens only once.
+      vector temp(alloc_);
+      for (; first != last; ++first) temp.emplace_back(*first);
+      insert_with(i, temp.size(), [&temp](T* dst, size_t k) {
+        temp.transfer(dst, k);
+      });
+    }
+    return begin() + i;
+  }
+  template <typename Range>
+  void append_range(Range&& range) {
+    using std::begin;
+    using std::end;
+    insert(std::as_const(*this).end(), begin(range), end(range));
+  }
+  template <typename... Args>
+  iterator emplace(const_iterator pos, Args&&... args) {
+    size_t i = pos - std::as_const(*this).begin();
+    if constexpr (is_trivially_relocatable_v<T>) {
+      // args may refer to an element that the shift is about to move.
+      alignas(T) unsigned char tmp[sizeof(T)];
+      T* v = new (tmp) T(std::forward<Args>(args)...);
+      bool placed = false;
+      try {
+        insert_with(i, 1, [v, &placed](T* dst, size_t) {
+          relocate(v, 1, dst);
+          placed = true;
+        });
+      } catch (...) {
+        if (!placed) v->~T();
+        throw;
+      }
+    } else {
+      insert_with(i, 1, [&](T* dst, size_t) {
+        new (dst) T(std::forward<Args>(args)...);
+      });
     }
     return begin() + i;
   }
   iterator erase(const_iterator pos) { return erase(pos, pos + 1); }
   iterator erase(const_iterator first, const_iterator last) {
-    if (first >= last) return begin() + (first - begin());
-    auto d = std::distance(first, last);
-    size_t i = first - begin();
-    size_t j = last - begin();
-    if (data_.index() == 2) {
-      if (i == 0 && j == std::get<2>(data_)->size) {
-        clear();
-      } else if ((int)std::get<2>(data_)->size == d + 1) {
-        T v = std::get<2>(data_)->data[0];
-        set_data(v);
-      } else {
-        shared_array* t = resize_vector(std::get<2>(data_)->capacity);
+    size_t i = first - std::as_const(*this).begin();
+    size_t j = last - std::as_const(*this).begin();
+    if (i >= j) return begin() + i;
+    size_t n = size();
+    size_t rest = n - (j - i);
+    if (rest == 0) {
+      clear();
+    } else if (!on_heap() || !array()->shared()) {
+      erase_in_place(data(), n, i, j);
+      set_size(rest);
+    } else if (rest <= N) {
+      to_inline([i, j, rest](shared_array* old, T* dst) {
+        copy_construct(old->data(), i, dst);
         try {
-          std::move(t->data + j, t->end(), t->data + i);
-          std::destroy(t->end() - d, t->end());
+          copy_construct(old->data() + j, old->size - j, dst + i);
         } catch (...) {
-          operator delete(t);
+          std::destroy_n(dst, i);
           throw;
         }
-        t->size -= d;
-        set_data(t);
+        return rest;
+      });
+    } else {
+      // Copy both parts: going through transfer() would look at shared()
+      // again, and relocate the prefix if the other owners left meanwhile.
+      shared_array* t = new_shared(array()->capacity);
+      try {
+        copy_construct(heap_, i, t->data());
+        t->size = i;
+        copy_construct(heap_ + j, n - j, t->end());
+      } catch (...) {
+        std::destroy_n(t->data(), t->size);
+        deallocate(t);
+        throw;
       }
-    } else if (data_.index() == 1) {
-      data_ = std::monostate();
+      t->size = rest;
+      set_data(t);
     }
     return begin() + i;
   }
 
-  template <typename V>
-  friend void swap(vector<V>&, vector<V>&) noexcept;
+  /** Writes the elements to path, trivially copyable types only. */
+  void save(char const* path) const {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "save() writes elements as raw bytes");
+    file_header h = {{'C', 'O', 'W', 'V', 'E', 'C', '0', '2'},
+                     type_hash(),
+                     sizeof(T),
+                     size(),
+                     size(),
+                     sizeof(shared_array)};
+    alignas(shared_array) unsigned char image[sizeof(shared_array)] = {};
+    shared_array* a = new (image) shared_array(size(), alloc_);
+    a->size = size();
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) throw std::system_error(errno, std::generic_category(), path);
+    bool ok = write_all(fd, &h, sizeof(h)) &&
+              write_all(fd, image, bytes(0)) &&
+              write_all(fd, data(), size() * sizeof(T));
+    int err = errno;
+    a->~shared_array();
+    if (close(fd) != 0 && ok) {
+      ok = false;
+      err = errno;
+    }
+    if (!ok) throw std::system_error(err, std::generic_category(), path);
+  }
+  /** Maps a file written by save(). Nothing is read or copied up front:
+   * the pages come in as they are touched and stay shared with the page
+   * cache until the first write, which detaches like any shared buffer.
+   */
+  static vector load(char const* path) {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "load() reads elements as raw bytes");
+    static_assert(std::is_same_v<Allocator, std::allocator<T>>,
+                  "load() maps the buffer instead of allocating it");
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) throw std::system_error(errno, std::generic_category(), path);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      int err = errno;
+      close(fd);
+      throw std::system_error(err, std::generic_category(), path);
+    }
+    size_t length = st.st_size;
+    if (length < sizeof(file_header) + bytes(0)) {
+      close(fd);
+      throw std::runtime_error("vector::load: file too short");
+    }
+    // Writable but private: reference counting dirties the header page
+    // only, the elements stay clean pages of the file.
+    void* mem =
+        mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    int err = errno;
+    close(fd);
+    if (mem == MAP_FAILED)
+      throw std::system_error(err, std::generic_category(), path);
+    file_header const& h = *static_cast<file_header*>(mem);
+    size_t size = h.size;
+    size_t capacity = h.capacity;
+    char const* error = nullptr;
+    if (std::memcmp(h.magic, "COWVEC02", 8) != 0) {
+      error = "vector::load: not a saved vector";
+    } else if (h.type_hash != type_hash() || h.element_size != sizeof(T)) {
+      error = "vector::load: saved with another element type";
+    } else if (h.data_offset != sizeof(shared_array)) {
+      error = "vector::load: saved with another alignment";
+    } else if (size > capacity || capacity > (length - sizeof(file_header) -
+                                              bytes(0)) / sizeof(T)) {
+      error = "vector::load: file is truncated";
+    } else if (length != sizeof(file_header) + bytes(capacity)) {
+      // unmap_file() knows the buffer, not the file: the two must agree.
+      error = "vector::load: trailing data after the saved vector";
+    }
+    if (error) {
+      munmap(mem, length);
+      throw std::runtime_error(error);
+    }
+    shared_array* a = new (static_cast<char*>(mem) + sizeof(file_header))
+        shared_array(capacity, chunk_allocator());
+    a->size = size;
+    a->owners.store(1 | FILE_BACKED, std::memory_order_relaxed);
+    vector result;
+    result.set_data(a);
+    return result;
+  }
+
+  friend void swap(vector& a, vector& b) noexcept(
+      std::is_nothrow_move_constructible_v<T>) {
+    if (&a == &b) return;
+    vector temp(std::move(a));
+    a = std::move(b);
+    b = std::move(temp);
+  }
 };
 
-template <typename V>
-void swap(vector<V>& a, vector<V>& b) noexcept {
-  std::swap(a.data_, b.data_);
-}
+namespace detail {
+/** Types whose == holds exactly when the object bytes are equal. */
+template <typename T>
+inline constexpr bool bytewise_equal_v =
+    std::is_integral_v<T> || std::is_enum_v<T> || std::is_pointer_v<T>;
 
+/** Index of the first i < n with a[i] != b[i], or n. */
 template <typename T>
-bool operator==(vector<T> const& a, vector<T> const& b) {
-  return std::equal(a.begin(), a.end(), b.begin(), b.end());
+size_t first_mismatch(T const* a, T const* b, size_t n) {
+  // memcmp is vectorized, but only tells which block differs.
+  constexpr size_t block = std::max<size_t>(1, 256 / sizeof(T));
+  size_t i = 0;
+  while (i + block <= n && std::memcmp(a + i, b + i, block * sizeof(T)) == 0)
+    i += block;
+  while (i < n && a[i] == b[i]) ++i;
+  return i;
 }
+}  // namespace detail
 
-template <typename T>
-bool operator!=(vector<T> const& a, vector<T> const& b) {
+template <typename T, size_t N, typename G, typename A>
+bool operator==(vector<T, N, G, A> const& a, vector<T, N, G, A> const& b) {
+  if (a.size() != b.size()) return false;
+  // Copies sharing a buffer are equal, unless T's == isn't reflexive.
+  if constexpr (!std::is_floating_point_v<T>) {
+    if (a.data() == b.data()) return true;
+  }
+  if constexpr (detail::bytewise_equal_v<T>) {
+    return a.empty() ||
+           std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0;
+  } else {
+    return std::equal(a.begin(), a.end(), b.begin());
+  }
+}
+
+template <typename T, size_t N, typename G, typename A>
+bool operator!=(vector<T, N, G, A> const& a, vector<T, N, G, A> const& b) {
   return !(a == b);
 }
 
-template <typename T>
-bool operator<(vector<T> const& a, vector<T> const& b) {
-  return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end());
+template <typename T, size_t N, typename G, typename A>
+bool operator<(vector<T, N, G, A> const& a, vector<T, N, G, A> const& b) {
+  if (a.data() == b.data() && a.size() == b.size()) return false;
+  if constexpr (detail::bytewise_equal_v<T>) {
+    size_t n = std::min(a.size(), b.size());
+    size_t i = detail::first_mismatch(a.data(), b.data(), n);
+    return i == n ? a.size() < b.size() : a[i] < b[i];
+  } else {
+    return std::lexicographical_compare(a.begin(), a.end(), b.begin(),
+                                        b.end());
+  }
 }
 
-template <typename T>
-bool operator<=(vector<T> const& a, vector<T> const& b) {
+template <typename T, size_t N, typename G, typename A>
+bool operator<=(vector<T, N, G, A> const& a, vector<T, N, G, A> const& b) {
   return !(b < a);
 }
 
-template <typename T>
-bool operator>(vector<T> const& a, vector<T> const& b) {
+template <typename T, size_t N, typename G, typename A>
+bool operator>(vector<T, N, G, A> const& a, vector<T, N, G, A> const& b) {
   return b < a;
 }
 
-template <typename T>
-bool operator>=(vector<T> const& a, vector<T> const& b) {
+template <typename T, size_t N, typename G, typename A>
+bool operator>=(vector<T, N, G, A> const& a, vector<T, N, G, A> const& b) {
   return !(a < b);
 }
+
+namespace detail {
+inline size_t popcount(uint64_t w) noexcept { return __builtin_popcountll(w); }
+inline size_t lowest_bit(uint64_t w) noexcept { return __builtin_ctzll(w); }
+}  // namespace detail
+
+/**
+ * Bit-packed vector<bool>. The bits live in 64-bit words of an ordinary
+ * vector, which supplies copy-on-write and the inline buffer; N counts
+ * bits. Bits are not addressable, so references are proxies. Bits past
+ * size() in the last word are kept zero, which lets count, comparisons
+ * and bitwise operations work a word at a time.
+ *
+ * A reduced contract: the bit count is kept beside the word vector, so
+ * this is a word over the sizeof bound at the top of this file, and there
+ * is no insert, erase, emplace_back, assign, data, unshare or slice. Bits
+ * are appended and removed at the end only.
+ */
+template <size_t N, typename Growth, typename Allocator>
+class vector<bool, N, Growth, Allocator> {
+  typedef uint64_t word;
+  static constexpr size_t BITS = 64;
+  typedef vector<word, (N + BITS - 1) / BITS, Growth,
+                 typename std::allocator_traits<Allocator>::
+                     template rebind_alloc<word>>
+      words_type;
+
+  words_type words_;
+  size_t size_;
+
+  static size_t words_for(size_t bits) noexcept {
+    return (bits + BITS - 1) / BITS;
+  }
+  static word mask(size_t index) noexcept { return word(1) << index % BITS; }
+  /** Clears the bits past the first bits in their word, detaching only
+   * if one is set.
+   */
+  void trim(size_t bits) {
+    if (bits % BITS == 0) return;
+    word tail = ~word(0) << bits % BITS;
+    size_t last = bits / BITS;
+    if (std::as_const(words_)[last] & tail) words_[last] &= ~tail;
+  }
+  template <typename Op>
+  vector& combine(vector const& other, Op op) {
+    word* dst = words_.data();
+    word const* src = other.words_.data();
+    for (size_t i = 0, n = words_.size(); i != n; ++i)
+      dst[i] = op(dst[i], src[i]);
+    return *this;
+  }
+  template <typename It>
+  using require_input_iterator = std::enable_if_t<std::is_convertible_v<
+      typename std::iterator_traits<It>::iterator_category,
+      std::input_iterator_tag>>;
+
+ public:
+  class reference {
+   public:
+    operator bool() const noexcept { return *word_ & mask_; }
+    reference& operator=(bool value) noexcept {
+      if (value) {
+        *word_ |= mask_;
+      } else {
+        *word_ &= ~mask_;
+      }
+      return *this;
+    }
+    reference& operator=(reference const& other) noexcept {
+      return *this = bool(other);
+    }
+    void flip() noexcept { *word_ ^= mask_; }
+    friend void swap(reference a, reference b) noexcept {
+      bool t = a;
+      a = bool(b);
+      b = t;
+    }
+
+   private:
+    friend class vector;
+    reference(word* w, word mask) noexcept : word_(w), mask_(mask) {}
+
+    word* word_;
+    word mask_;
+  };
+
+ private:
+  template <typename W, typename Ref>
+  struct iterator_t {
+    using difference_type = std::ptrdiff_t;
+    using value_type = bool;
+    using pointer = void;
+    using reference = Ref;
+    using iterator_category = std::random_access_iterator_tag;
+
+    W* words;
+    size_t index;
+
+    iterator_t() noexcept : words(nullptr), index(0) {}
+    iterator_t(W* words, size_t index) noexcept
+        : words(words), index(index) {}
+    template <typename V, typename R,
+              typename = std::enable_if_t<std::is_convertible_v<V*, W*>>>
+    iterator_t(iterator_t<V, R> const& other) noexcept
+        : words(other.words), index(other.index) {}
+
+    reference operator*() const noexcept {
+      if constexpr (std::is_same_v<Ref, bool>) {
+        return words[index / BITS] & mask(index);
+      } else {
+        return Ref(words + index / BITS, mask(index));
+      }
+    }
+    reference operator[](difference_type n) const noexcept {
+      return *(*this + n);
+    }
+
+    iterator_t& operator++() noexcept {
+      ++index;
+      return *this;
+    }
+    iterator_t operator++(int) noexcept {
+      iterator_t old = *this;
+      ++index;
+      return old;
+    }
+    iterator_t& operator--() noexcept {
+      --index;
+      return *this;
+    }
+    iterator_t operator--(int) noexcept {
+      iterator_t old = *this;
+      --index;
+      return old;
+    }
+    iterator_t& operator+=(difference_type n) noexcept {
+      index += n;
+      return *this;
+    }
+    iterator_t& operator-=(difference_type n) noexcept {
+      index -= n;
+      return *this;
+    }
+    friend iterator_t operator+(iterator_t it, difference_type n) noexcept {
+      return it += n;
+    }
+    friend iterator_t operator+(difference_type n, iterator_t it) noexcept {
+      return it += n;
+    }
+    friend iterator_t operator-(iterator_t it, difference_type n) noexcept {
+      return it -= n;
+    }
+    friend difference_type operator-(iterator_t const& a,
+                                     iterator_t const& b) noexcept {
+      return difference_type(a.index) - difference_type(b.index);
+    }
+
+    friend bool operator==(iterator_t const& a, iterator_t const& b) noexcept {
+      return a.index == b.index;
+    }
+    friend bool operator!=(iterator_t const& a, iterator_t const& b) noexcept {
+      return a.index != b.index;
+    }
+    friend bool operator<(iterator_t const& a, iterator_t const& b) noexcept {
+      return a.index < b.index;
+    }
+    friend bool operator>(iterator_t const& a, iterator_t const& b) noexcept {
+      return b < a;
+    }
+    friend bool operator<=(iterator_t const& a, iterator_t const& b) noexcept {
+      return !(b < a);
+    }
+    friend bool operator>=(iterator_t const& a, iterator_t const& b) noexcept {
+      return !(a < b);
+    }
+  };
+
+ public:
+  typedef bool value_type;
+  typedef Allocator allocator_type;
+  typedef bool const_reference;
+  typedef iterator_t<word const, bool> const_iterator;
+  typedef iterator_t<word, reference> iterator;
+  typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+  typedef std::reverse_iterator<iterator> reverse_iterator;
+
+  vector() noexcept(noexcept(Allocator())) : vector(Allocator()) {}
+  explicit vector(Allocator const& alloc) noexcept
+      : words_(typename words_type::allocator_type(alloc)), size_(0) {}
+  vector(size_t count, bool value, Allocator const& alloc = Allocator())
+      : words_(words_for(count), value ? ~word(0) : word(0),
+               typename words_type::allocator_type(alloc)),
+        size_(count) {
+    trim(count);
+  }
+  template <typename InputIterator,
+            typename = require_input_iterator<InputIterator>>
+  vector(InputIterator first, InputIterator last,
+         Allocator const& alloc = Allocator())
+      : vector(alloc) {
+    for (; first != last; ++first) push_back(*first);
+  }
+  vector(vector const&) = default;
+  vector(vector&& other) noexcept
+      : words_(std::move(other.words_)), size_(other.size_) {
+    other.size_ = 0;
+  }
+  vector& operator=(vector const&) = default;
+  vector& operator=(vector&& other) noexcept {
+    words_ = std::move(other.words_);
+    size_ = std::exchange(other.size_, 0);
+    return *this;
+  }
+
+  allocator_type get_allocator() const noexcept {
+    return allocator_type(words_.get_allocator());
+  }
+
+  bool empty() const noexcept { return size_ == 0; }
+  size_t size() const noexcept { return size_; }
+  size_t capacity() const noexcept { return words_.capacity() * BITS; }
+  void clear() {
+    words_.clear();
+    size_ = 0;
+  }
+  void reserve(size_t new_capacity) { words_.reserve(words_for(new_capacity)); }
+  void shrink_to_fit() { words_.shrink_to_fit(); }
+
+  bool operator[](size_t index) const noexcept {
+    return words_[index / BITS] & mask(index);
+  }
+  reference operator[](size_t index) {
+    return reference(&words_[index / BITS], mask(index));
+  }
+  bool front() const noexcept { return (*this)[0]; }
+  bool back() const noexcept { return (*this)[size_ - 1]; }
+  reference front() { return (*this)[0]; }
+  reference back() { return (*this)[size_ - 1]; }
+
+  const_iterator begin() const noexcept {
+    return const_iterator(words_.data(), 0);
+  }
+  const_iterator end() const noexcept {
+    return const_iterator(words_.data(), size_);
+  }
+  iterator begin() { return iterator(words_.data(), 0); }
+  iterator end() { return iterator(words_.data(), size_); }
+
+  /** Writable view of the bits, taken after detaching once. */
+  struct span {
+    word* words;
+    size_t count;
+
+    size_t size() const noexcept { return count; }
+    iterator begin() const noexcept { return iterator(words, 0); }
+    iterator end() const noexcept { return iterator(words, count); }
+    reference operator[](size_t index) const noexcept {
+      return begin()[index];
+    }
+  };
+  span mutable_span() { return span{words_.unshare(), size_}; }
+
+  const_reverse_iterator rbegin() const noexcept {
+    return const_reverse_iterator(end());
+  }
+  const_reverse_iterator rend() const noexcept {
+    return const_reverse_iterator(begin());
+  }
+  reverse_iterator rbegin() { return reverse_iterator(end()); }
+  reverse_iterator rend() { return reverse_iterator(begin()); }
+
+  const_iterator cbegin() const noexcept { return begin(); }
+  const_iterator cend() const noexcept { return end(); }
+
+  void push_back(bool value) {
+    if (size_ % BITS == 0) {
+      words_.push_back(value);
+    } else if (value) {
+      words_[size_ / BITS] |= mask(size_);
+    }
+    ++size_;
+  }
+  void pop_back() {
+    if (size_ == 0) return;
+    size_t n = size_ - 1;
+    if (n % BITS == 0) {
+      words_.pop_back();
+    } else if (std::as_const(*this)[n]) {
+      words_[n / BITS] &= ~mask(n);
+    }
+    size_ = n;
+  }
+  void resize(size_t new_size, bool value = false) {
+    if (new_size <= size_) {
+      // Detaches first, if at all, so that nothing throws past it.
+      trim(new_size);
+      words_.resize(words_for(new_size));
+    } else {
+      word tail = ~word(0) << size_ % BITS;
+      bool fill = value && size_ % BITS != 0;
+      if (fill) words_[size_ / BITS] |= tail;
+      try {
+        words_.resize(words_for(new_size), value ? ~word(0) : word(0));
+      } catch (...) {
+        if (fill) words_[size_ / BITS] &= ~tail;
+        throw;
+      }
+      trim(new_size);
+    }
+    size_ = new_size;
+  }
+
+  void flip() {
+    for (word& w : words_.mutable_span()) w = ~w;
+    trim(size_);
+  }
+  /** Number of set bits. */
+  size_t count() const noexcept {
+    size_t result = 0;
+    for (word w : words_) result += detail::popcount(w);
+    return result;
+  }
+  /** Index of the first set bit at or after from, or size(). */
+  size_t find_first(size_t from = 0) const noexcept {
+    if (from >= size_) return size_;
+    word const* w = words_.data();
+    size_t i = from / BITS;
+    word bits = w[i] & ~word(0) << from % BITS;
+    for (size_t n = words_.size(); bits == 0;) {
+      if (++i == n) return size_;
+      bits = w[i];
+    }
+    return i * BITS + detail::lowest_bit(bits);
+  }
+
+  /** Bitwise operations take vectors of the same size. */
+  vector& operator&=(vector const& other) {
+    return combine(other, [](word a, word b) { return a & b; });
+  }
+  vector& operator|=(vector const& other) {
+    return combine(other, [](word a, word b) { return a | b; });
+  }
+  vector& operator^=(vector const& other) {
+    return combine(other, [](word a, word b) { return a ^ b; });
+  }
+  friend vector operator&(vector a, vector const& b) { return a &= b; }
+  friend vector operator|(vector a, vector const& b) { return a |= b; }
+  friend vector operator^(vector a, vector const& b) { return a ^= b; }
+  friend vector operator~(vector a) {
+    a.flip();
+    return a;
+  }
+
+  friend bool operator==(vector const& a, vector const& b) {
+    return a.size_ == b.size_ && a.words_ == b.words_;
+  }
+  friend bool operator!=(vector const& a, vector const& b) {
+    return !(a == b);
+  }
+  friend bool operator<(vector const& a, vector const& b) {
+    size_t n = std::min(a.size_, b.size_);
+    word const* x = a.words_.data();
+    word const* y = b.words_.data();
+    for (size_t i = 0; i * BITS < n; ++i) {
+      word diff = x[i] ^ y[i];
+      if (diff == 0) continue;
+      size_t bit = detail::lowest_bit(diff);
+      if (i * BITS + bit >= n) break;
+      return y[i] >> bit & 1;
+    }
+    return a.size_ < b.size_;
+  }
+  friend bool operator<=(vector const& a, vector const& b) {
+    return !(b < a);
+  }
+  friend bool operator>(vector const& a, vector const& b) { return b < a; }
+  friend bool operator>=(vector const& a, vector const& b) {
+    return !(a < b);
+  }
+
+  friend void swap(vector& a, vector& b) noexcept {
+    swap(a.words_, b.words_);
+    std::swap(a.size_, b.size_);
+  }
+};
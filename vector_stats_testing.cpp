@@ -0,0 +1,55 @@
+#define VECTOR_STATS 1
+
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <cstring>
+#include "counted.h"
+#include "fault_injection.h"
+#include "vector.h"
+
+namespace {
+struct stats_probe {
+  int v;
+};
+}  // namespace
+
+TEST(correctness, stats) {
+  vector_stats& s = vector_stats::of<stats_probe>();
+  s.reset();
+  vector<stats_probe> c;
+  for (int i = 0; i != 10; ++i) c.push_back({i});
+  EXPECT_EQ(3u, s.push_back_reallocations);
+  EXPECT_EQ(3u, s.allocations);
+  EXPECT_EQ(0u, s.bytes_copied);
+
+  vector<stats_probe> d = c;
+  EXPECT_EQ(0u, s.detaches);
+  d.begin();
+  EXPECT_EQ(1u, s.detaches);
+  EXPECT_EQ(4u, s.allocations);
+  EXPECT_EQ(10 * sizeof(stats_probe), s.bytes_copied);
+
+  d.shrink_to_fit();
+  c.shrink_to_fit();
+  EXPECT_EQ(1u, s.shrinks);
+  EXPECT_GE(vector_stats::global().allocations, s.allocations);
+
+  FILE* out = std::tmpfile();
+  vector_stats::dump(out);
+  std::rewind(out);
+  char line[256];
+  ASSERT_TRUE(std::fgets(line, sizeof line, out));
+  EXPECT_EQ(0, std::strncmp(line, "all vectors:", 12));
+  std::fclose(out);
+}
+
+TEST(exceptions, stats_push_back) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    vector<counted> c;
+    for (int i = 0; i != 10; ++i) c.push_back(i);
+    vector<counted> d = c;
+    d[0] = -1;
+    EXPECT_EQ(0, std::as_const(c)[0]);
+  });
+}
@@ -1,10 +1,103 @@
+
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
 #include "counted.h"
 #include "fault_injection.h"
 #include "vector.h"
 
 typedef vector<counted> container;
 typedef vector<int> container_int;
+typedef vector<std::string> container_str;
+typedef vector<counted, 3> container_small;
+
+struct small_mmap_growth : doubling_growth {
+  static constexpr size_t mmap_threshold = 4096;
+};
+
+struct parallel_copy_growth : doubling_growth {
+  static constexpr size_t parallel_copy_threshold = 1000;
+};
+
+struct page_aligned_growth : doubling_growth {
+  static constexpr size_t alignment = 4096;
+  static constexpr size_t mmap_threshold = 4096;
+};
+
+namespace {
+struct relocatable {
+  relocatable(int v) : p(new int(v)) {}
+  relocatable(relocatable const& other) : p(new int(*other.p)) {}
+  relocatable& operator=(relocatable const& other) {
+    *p = *other.p;
+    return *this;
+  }
+  ~relocatable() { delete p; }
+  operator int() const { return *p; }
+
+  int* p;
+};
+}  // namespace
+
+template <>
+struct is_trivially_relocatable<relocatable> : std::true_type {};
+
+namespace {
+struct counting_resource : std::pmr::memory_resource {
+  size_t allocated = 0;
+  size_t live = 0;
+
+ private:
+  void* do_allocate(size_t bytes, size_t align) override {
+    ++allocated;
+    ++live;
+    return std::pmr::new_delete_resource()->allocate(bytes, align);
+  }
+  void do_deallocate(void* p, size_t bytes, size_t align) override {
+    --live;
+    std::pmr::new_delete_resource()->deallocate(p, bytes, align);
+  }
+  bool do_is_equal(memory_resource const& other) const noexcept override {
+    return this == &other;
+  }
+};
+}  // namespace
+
+namespace {
+std::atomic<size_t> tracked_alive{0};
+std::atomic<int> tracked_throw_on{-1};
+
+struct tracked {
+  tracked(int v) : v(v) { ++tracked_alive; }
+  tracked(tracked const& other) : v(other.v) {
+    if (v == tracked_throw_on) throw std::runtime_error("tracked copy");
+    ++tracked_alive;
+  }
+  ~tracked() { --tracked_alive; }
+
+  int v;
+};
+}  // namespace
+
+typedef vector<counted, 1, doubling_growth,
+               std::pmr::polymorphic_allocator<counted>>
+    container_pmr;
+
+typedef vector<relocatable> container_reloc;
 
 TEST(correctness, default_ctor) {
   faulty_run([] {
@@ -57,6 +150,46 @@ TEST(correctness, push_back_big) {
   });
 }
 
+TEST(correctness, push_back_in_place) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    c.reserve(10);
+    counted const* p = c.data();
+    for (size_t i = 0; i != 10; ++i) c.push_back(i);
+    EXPECT_EQ(p, c.data());
+    EXPECT_EQ(10u, c.capacity());
+    for (size_t i = 0; i != 10; ++i) EXPECT_EQ((int)i, c[i]);
+  });
+}
+
+TEST(correctness, push_back_shared) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    c.reserve(10);
+    c.push_back(1);
+    c.push_back(2);
+    container d = c;
+    d.push_back(3);
+    EXPECT_EQ(2u, c.size());
+    EXPECT_EQ(3u, d.size());
+    c.push_back(4);
+    EXPECT_EQ(4, c[2]);
+    EXPECT_EQ(3, d[2]);
+  });
+}
+
+TEST(correctness, emplace_back) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    for (size_t i = 0; i != 20; ++i) EXPECT_EQ((int)i, c.emplace_back(i));
+    EXPECT_EQ(20u, c.size());
+    for (size_t i = 0; i != 20; ++i) EXPECT_EQ((int)i, c[i]);
+  });
+}
+
 TEST(correctness, pop_back) {
   faulty_run([] {
     counted::no_new_instances_guard g;
@@ -85,6 +218,35 @@ TEST(correctness, pop_back) {
     c.pop_back();
     EXPECT_TRUE(c.empty());
     EXPECT_EQ(0u, c.size());
+    c.pop_back();
+    EXPECT_TRUE(c.empty());
+  });
+}
+
+TEST(correctness, pop_back_in_place) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    for (size_t i = 0; i != 10; ++i) c.push_back(i);
+    counted const* p = c.data();
+    while (c.size() > 1) c.pop_back();
+    EXPECT_EQ(p, c.data());
+    EXPECT_EQ(0, c[0]);
+  });
+}
+
+TEST(correctness, pop_back_shared) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    for (size_t i = 0; i != 5; ++i) c.push_back(i);
+    container d = c;
+    d.pop_back();
+    d.pop_back();
+    EXPECT_EQ(5u, c.size());
+    EXPECT_EQ(3u, d.size());
+    EXPECT_EQ(4, c[4]);
+    EXPECT_EQ(2, d[2]);
   });
 }
 
@@ -177,6 +339,1037 @@ TEST(correctness, assignment_self_empty) {
   });
 }
 
+TEST(correctness, move_ctor) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    c.push_back(1);
+    c.push_back(2);
+    c.push_back(3);
+    counted const* p = std::as_const(c).data();
+
+    container d = std::move(c);
+    EXPECT_TRUE(c.empty());
+    EXPECT_EQ(3u, d.size());
+    EXPECT_EQ(p, std::as_const(d).data());
+    EXPECT_EQ(3, d[2]);
+  });
+}
+
+TEST(correctness, move_ctor_single) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    c.push_back(42);
+    container d = std::move(c);
+    EXPECT_TRUE(c.empty());
+    EXPECT_EQ(1u, d.size());
+    EXPECT_EQ(42, d[0]);
+  });
+}
+
+TEST(correctness, move_assignment) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    c.push_back(1);
+    c.push_back(2);
+    c.push_back(3);
+
+    container d;
+    d.push_back(4);
+    d = std::move(c);
+    EXPECT_TRUE(c.empty());
+    EXPECT_EQ(3u, d.size());
+    EXPECT_EQ(1, d[0]);
+    EXPECT_EQ(3, d[2]);
+  });
+}
+
+TEST(correctness, push_back_rvalue) {
+  faulty_run([] {
+    container_str c;
+    std::string s(100, 'a');
+    char const* p = s.data();
+    c.push_back(std::move(s));
+    EXPECT_EQ(p, c[0].data());
+    for (size_t i = 0; i != 20; ++i) c.push_back(std::string(100, 'b'));
+    EXPECT_EQ(p, c[0].data());
+    EXPECT_EQ(21u, c.size());
+  });
+}
+
+TEST(correctness, emplace) {
+  faulty_run([] {
+    container_str c;
+    c.emplace_back(3, 'a');
+    c.emplace_back(3, 'c');
+    c.emplace(c.begin() + 1, 3, 'b');
+    c.insert(c.begin(), std::string("z"));
+    EXPECT_EQ(4u, c.size());
+    EXPECT_EQ("z", c[0]);
+    EXPECT_EQ("aaa", c[1]);
+    EXPECT_EQ("bbb", c[2]);
+    EXPECT_EQ("ccc", c[3]);
+  });
+}
+
+TEST(correctness, relocate_on_growth) {
+  faulty_run([] {
+    container_reloc c;
+    c.push_back(1);
+    c.push_back(2);
+    int* p = c[0].p;
+    for (size_t i = 0; i != 20; ++i) c.push_back(i);
+    EXPECT_EQ(p, c[0].p);
+    c.shrink_to_fit();
+    EXPECT_EQ(p, c[0].p);
+    EXPECT_EQ(22u, c.size());
+    EXPECT_EQ(19, c[21]);
+  });
+}
+
+TEST(correctness, relocate_insert_erase) {
+  faulty_run([] {
+    container_reloc c;
+    for (size_t i = 0; i != 6; ++i) c.push_back(i);
+    c.erase(c.begin() + 1, c.begin() + 3);
+    c.insert(c.begin() + 1, 42);
+    EXPECT_EQ(5u, c.size());
+    EXPECT_EQ(0, c[0]);
+    EXPECT_EQ(42, c[1]);
+    EXPECT_EQ(3, c[2]);
+    EXPECT_EQ(4, c[3]);
+    EXPECT_EQ(5, c[4]);
+
+    container_reloc d = c;
+    d.erase(std::as_const(d).begin());
+    EXPECT_EQ(0, c[0]);
+    EXPECT_EQ(42, d[0]);
+  });
+}
+
+TEST(correctness, trivial_insert_erase) {
+  faulty_run([] {
+    container_int c;
+    for (int i = 0; i != 100; ++i) c.insert(c.begin(), i);
+    c.erase(c.begin() + 10, c.begin() + 90);
+    EXPECT_EQ(20u, c.size());
+    EXPECT_EQ(99, c[0]);
+    EXPECT_EQ(90, c[9]);
+    EXPECT_EQ(9, c[10]);
+    EXPECT_EQ(0, c[19]);
+  });
+}
+
+TEST(correctness, copy_across_threads) {
+  container_int c;
+  for (int i = 0; i != 1000; ++i) c.push_back(i);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t != 4; ++t) {
+    threads.emplace_back([&c, t] {
+      for (int k = 0; k != 100; ++k) {
+        container_int d = c;
+        container_int const& cd = d;
+        EXPECT_EQ(999, cd[999]);
+        d[0] = t;
+        EXPECT_EQ(t, d[0]);
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+  EXPECT_EQ(0, c[0]);
+}
+
+TEST(correctness, erase_while_copy_released) {
+  for (int round = 0; round != 1000; ++round) {
+    container_reloc c;
+    for (int i = 0; i != 100; ++i) c.push_back(i);
+    auto d = std::make_unique<container_reloc>(c);
+    container_reloc const& cc = c;
+    std::atomic<bool> go(false);
+    std::thread t([&d, &go] {
+      while (!go.load()) {
+      }
+      d.reset();
+    });
+    go.store(true);
+    c.erase(cc.begin() + 10, cc.begin() + 20);
+    t.join();
+    ASSERT_EQ(90u, cc.size());
+    EXPECT_EQ(9, *cc[9].p);
+    EXPECT_EQ(20, *cc[10].p);
+    EXPECT_EQ(99, *cc[89].p);
+  }
+}
+
+namespace {
+struct polymorphic {
+  explicit polymorphic(int v) : v(v) {}
+  virtual ~polymorphic() = default;
+  int v;
+};
+}  // namespace
+
+TEST(correctness, non_standard_layout) {
+  vector<polymorphic> c;
+  for (int i = 0; i != 100; ++i) c.emplace_back(i);
+  vector<polymorphic> d = c;
+  d.emplace_back(100);
+  EXPECT_EQ(99, std::as_const(c).back().v);
+  EXPECT_EQ(100, std::as_const(d).back().v);
+}
+
+TEST(correctness, small_object) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container_small c;
+    c.push_back(1);
+    c.push_back(2);
+    c.push_back(3);
+    EXPECT_EQ(3u, c.capacity());
+    EXPECT_GE(static_cast<void const*>(c.data()), static_cast<void*>(&c));
+    EXPECT_LT(static_cast<void const*>(c.data()), static_cast<void*>(&c + 1));
+
+    container_small d = c;
+    d[1] = 20;
+    EXPECT_EQ(2, c[1]);
+    EXPECT_EQ(20, d[1]);
+
+    c.push_back(4);
+    EXPECT_LT(3u, c.capacity());
+    EXPECT_EQ(4u, c.size());
+    EXPECT_EQ(4, c[3]);
+  });
+}
+
+TEST(correctness, small_object_insert_erase) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container_small c;
+    c.insert(c.begin(), 3);
+    c.insert(c.begin(), 1);
+    c.insert(c.begin() + 1, 2);
+    EXPECT_EQ(3u, c.capacity());
+    EXPECT_EQ(1, c[0]);
+    EXPECT_EQ(2, c[1]);
+    EXPECT_EQ(3, c[2]);
+    c.erase(c.begin());
+    EXPECT_EQ(2u, c.size());
+    EXPECT_EQ(2, c[0]);
+    EXPECT_EQ(3, c[1]);
+  });
+}
+
+TEST(correctness, small_object_back_from_heap) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container_small c;
+    for (size_t i = 0; i != 5; ++i) c.push_back(i);
+    container_small d = c;
+    d.pop_back();
+    d.pop_back();
+    EXPECT_EQ(5u, c.size());
+    EXPECT_EQ(3u, d.size());
+    EXPECT_EQ(2, d[2]);
+
+    container_small e = c;
+    container_small const& ce = e;
+    e.erase(ce.begin() + 1, ce.begin() + 3);
+    EXPECT_EQ(3u, e.capacity());
+    EXPECT_EQ(0, e[0]);
+    EXPECT_EQ(3, e[1]);
+    EXPECT_EQ(4, e[2]);
+
+    container_small f = c;
+    f.resize(2, 0);
+    EXPECT_EQ(3u, f.capacity());
+    EXPECT_EQ(1, f[1]);
+    EXPECT_EQ(4, c[4]);
+
+    c.pop_back();
+    container_small h = c;
+    h.pop_back();
+    EXPECT_EQ(3u, h.capacity());
+    EXPECT_EQ(2, h[2]);
+  });
+}
+
+TEST(correctness, small_object_swap) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container_small c, d;
+    c.push_back(1);
+    c.push_back(2);
+    for (size_t i = 0; i != 5; ++i) d.push_back(i + 10);
+    swap(c, d);
+    EXPECT_EQ(5u, c.size());
+    EXPECT_EQ(2u, d.size());
+    EXPECT_EQ(10, c[0]);
+    EXPECT_EQ(2, d[1]);
+    d = std::move(c);
+    EXPECT_TRUE(c.empty());
+    EXPECT_EQ(14, d[4]);
+  });
+}
+
+TEST(correctness, small_object_footprint) {
+  EXPECT_EQ(2u, container_int().capacity());
+  EXPECT_EQ(2 * sizeof(void*), sizeof(container_int));
+  EXPECT_EQ(2 * sizeof(void*), sizeof(vector<long>));
+  EXPECT_EQ(sizeof(void*) + 4 * sizeof(int), sizeof(vector<int, 4>));
+}
+
+TEST(correctness, const_access_no_detach) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    for (size_t i = 0; i != 5; ++i) c.push_back(i);
+    container d = c;
+    EXPECT_EQ(c.cbegin(), d.cbegin());
+    EXPECT_EQ(c.cend(), d.cend());
+    EXPECT_EQ(4, *d.crbegin());
+    EXPECT_EQ(std::as_const(c).data(), std::as_const(d).data());
+  });
+}
+
+TEST(correctness, mutable_span) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    for (size_t i = 0; i != 5; ++i) c.push_back(i);
+    container d = c;
+    container::span s = d.mutable_span();
+    EXPECT_EQ(5u, s.size());
+    EXPECT_NE(c.cbegin(), s.data());
+    EXPECT_EQ(d.cbegin(), s.data());
+    for (counted& e : s) e = e * 2;
+    EXPECT_EQ(s.data(), d.unshare());
+    EXPECT_EQ(3, c[3]);
+    EXPECT_EQ(6, d[3]);
+  });
+}
+
+TEST(correctness, growth_policy) {
+  faulty_run([] {
+    vector<int, 2, one_and_half_growth> c;
+    for (int i = 0; i != 5; ++i) c.push_back(i);
+    EXPECT_EQ(6u, c.capacity());
+    for (int i = 5; i != 7; ++i) c.push_back(i);
+    EXPECT_EQ(9u, c.capacity());
+
+    vector<int, 2, page_growth> d;
+    for (int i = 0; i != 5; ++i) d.push_back(i);
+    size_t header = 3 * sizeof(size_t);
+    EXPECT_EQ(0u, (header + d.capacity() * sizeof(int)) % 4096);
+    EXPECT_EQ(4, d[4]);
+  });
+}
+
+TEST(correctness, mmap_growth) {
+  faulty_run([] {
+    vector<int, 2, small_mmap_growth> c;
+    for (int i = 0; i != 100000; ++i) c.push_back(i);
+    vector<int, 2, small_mmap_growth> d = c;
+    for (int i = 0; i != 1000; ++i) c.push_back(-i);
+    c.reserve(1 << 20);
+    EXPECT_EQ(size_t(1) << 20, c.capacity());
+    EXPECT_EQ(101000u, c.size());
+    EXPECT_EQ(100000u, d.size());
+    for (int i = 0; i != 100000; ++i) {
+      ASSERT_EQ(i, c[i]);
+      ASSERT_EQ(i, d[i]);
+    }
+    EXPECT_EQ(-999, c.back());
+    c.push_back(c[5]);
+    EXPECT_EQ(5, c.back());
+  });
+}
+
+TEST(correctness, mmap_growth_relocatable) {
+  faulty_run([] {
+    vector<relocatable, 1, small_mmap_growth> c;
+    for (int i = 0; i != 5000; ++i) c.push_back(i);
+    for (int i = 0; i != 5000; ++i) ASSERT_EQ(i, c[i]);
+    c.erase(c.begin(), c.begin() + 4000);
+    c.shrink_to_fit();
+    EXPECT_EQ(4000, c[0]);
+  });
+}
+
+TEST(correctness, pmr_arena) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    alignas(64) unsigned char buf[4096];
+    std::pmr::monotonic_buffer_resource arena(buf, sizeof buf,
+                                              std::pmr::null_memory_resource());
+    container_pmr c(&arena);
+    for (int i = 0; i != 20; ++i) c.push_back(i);
+    EXPECT_EQ(&arena, c.get_allocator().resource());
+    auto p = reinterpret_cast<unsigned char const*>(c.data());
+    EXPECT_TRUE(p >= buf && p < buf + sizeof buf);
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(p) % alignof(counted));
+    for (int i = 0; i != 20; ++i) EXPECT_EQ(i, c[i]);
+  });
+}
+
+TEST(correctness, pmr_copy_move) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    counting_resource r1, r2;
+    {
+      container_pmr a(&r1);
+      for (int i = 0; i != 10; ++i) a.push_back(i);
+      EXPECT_EQ(1u, r1.live);
+
+      container_pmr b(&r2);
+      b = a;
+      EXPECT_EQ(&r2, b.get_allocator().resource());
+      EXPECT_EQ(0u, r2.allocated);
+      b.push_back(10);
+      EXPECT_EQ(1u, r2.live);
+      EXPECT_EQ(1u, r1.live);
+
+      container_pmr c(&r2);
+      c = std::move(a);
+      EXPECT_EQ(&r2, c.get_allocator().resource());
+      EXPECT_EQ(9, c.back());
+      EXPECT_EQ(10, b.back());
+
+      container_pmr d(std::move(c));
+      EXPECT_EQ(&r2, d.get_allocator().resource());
+      EXPECT_EQ(1u, r1.live);
+    }
+    EXPECT_EQ(0u, r1.live);
+    EXPECT_EQ(0u, r2.live);
+  });
+}
+
+namespace {
+/** Input iterator over an array, to exercise single-pass code paths. */
+template <typename T>
+struct single_pass {
+  using iterator_category = std::input_iterator_tag;
+  using value_type = T;
+  using difference_type = std::ptrdiff_t;
+  using pointer = T const*;
+  using reference = T const&;
+
+  T const* p;
+
+  reference operator*() const { return *p; }
+  single_pass& operator++() {
+    ++p;
+    return *this;
+  }
+  single_pass operator++(int) { return {p++}; }
+  bool operator==(single_pass const& other) const { return p == other.p; }
+  bool operator!=(single_pass const& other) const { return p != other.p; }
+};
+}  // namespace
+
+TEST(correctness, fill_ctor) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c(5, 7);
+    EXPECT_EQ(5u, c.size());
+    EXPECT_EQ(5u, c.capacity());
+    for (size_t i = 0; i != 5; ++i) EXPECT_EQ(7, c[i]);
+    container_small d(2, 3);
+    EXPECT_EQ(3u, d.capacity());
+    EXPECT_EQ(3, d[1]);
+    container_int e(0, 1);
+    EXPECT_TRUE(e.empty());
+  });
+}
+
+TEST(correctness, range_ctor) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    int src[] = {1, 2, 3, 4, 5, 6, 7};
+    container c(std::begin(src), std::end(src));
+    ASSERT_EQ(7u, c.size());
+    EXPECT_EQ(7u, c.capacity());
+    for (size_t i = 0; i != 7; ++i) EXPECT_EQ(src[i], c[i]);
+    container_small d(src, src + 2);
+    EXPECT_EQ(3u, d.capacity());
+    EXPECT_EQ(2, d[1]);
+  });
+}
+
+TEST(correctness, range_ctor_input_iterator) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    std::vector<counted> src(100, 0);
+    for (size_t i = 0; i != src.size(); ++i) src[i] = i;
+    container c(single_pass<counted>{src.data()},
+                single_pass<counted>{src.data() + src.size()});
+    ASSERT_EQ(100u, c.size());
+    for (size_t i = 0; i != 100; ++i) EXPECT_EQ(int(i), c[i]);
+  });
+}
+
+TEST(correctness, range_ctor_stream) {
+  std::string text;
+  for (int i = 0; i != 10000; ++i) text += std::to_string(i) + " ";
+  std::istringstream in(text);
+  container_int c(std::istream_iterator<int>(in),
+                  (std::istream_iterator<int>()));
+  ASSERT_EQ(10000u, c.size());
+  for (int i = 0; i != 10000; ++i) ASSERT_EQ(i, c[i]);
+}
+
+TEST(correctness, insert_count) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    for (int i = 0; i != 4; ++i) c.push_back(i);
+    c.reserve(20);
+    container const& cc = c;
+    auto it = c.insert(cc.begin() + 1, 3, c[3]);
+    EXPECT_EQ(c.begin() + 1, it);
+    int expected[] = {0, 3, 3, 3, 1, 2, 3};
+    ASSERT_EQ(7u, c.size());
+    for (size_t i = 0; i != 7; ++i) EXPECT_EQ(expected[i], c[i]);
+
+    container d = c;
+    d.insert(std::as_const(d).end(), 2, 9);
+    EXPECT_EQ(7u, c.size());
+    EXPECT_EQ(9u, d.size());
+    EXPECT_EQ(9, d[8]);
+    EXPECT_EQ(3, d[6]);
+  });
+}
+
+TEST(correctness, insert_range) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    int src[] = {10, 11, 12, 13, 14, 15};
+    container c;
+    c.push_back(1);
+    c.push_back(2);
+    container d = c;
+    c.insert(std::as_const(c).begin() + 1, std::begin(src), std::end(src));
+    int expected[] = {1, 10, 11, 12, 13, 14, 15, 2};
+    ASSERT_EQ(8u, c.size());
+    for (size_t i = 0; i != 8; ++i) EXPECT_EQ(expected[i], c[i]);
+    EXPECT_EQ(2u, d.size());
+
+    container_small e;
+    e.push_back(1);
+    container_small f = e;
+    for (int i = 0; i != 4; ++i) f.push_back(i);
+    container_small h = f;
+    f.erase(std::as_const(f).begin() + 1, std::as_const(f).end());
+    f.insert(std::as_const(f).begin(), src, src + 2);
+    EXPECT_EQ(3u, f.size());
+    EXPECT_EQ(10, f[0]);
+    EXPECT_EQ(1, f[2]);
+    EXPECT_EQ(5u, h.size());
+  });
+}
+
+TEST(correctness, insert_input_range) {
+  faulty_run([] {
+    container_int c;
+    c.push_back(1);
+    c.push_back(5);
+    std::istringstream in("2 3 4");
+    c.insert(std::as_const(c).begin() + 1, std::istream_iterator<int>(in),
+             std::istream_iterator<int>());
+    ASSERT_EQ(5u, c.size());
+    for (int i = 0; i != 5; ++i) EXPECT_EQ(i + 1, c[i]);
+  });
+}
+
+TEST(correctness, insert_sorted) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    for (int i = 0; i != 50; ++i) {
+      int v = (i * 37) % 50;
+      container const& cc = c;
+      auto pos = std::lower_bound(cc.begin(), cc.end(), v,
+                                  [](counted const& a, int b) { return a < b; });
+      c.insert(pos, v);
+    }
+    for (int i = 0; i != 50; ++i) ASSERT_EQ(i, c[i]);
+  });
+}
+
+TEST(correctness, insert_aliasing) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    for (int i = 0; i != 4; ++i) c.push_back(i);
+    c.reserve(10);
+    c.insert(std::as_const(c).begin(), c[2]);
+    c.insert(std::as_const(c).begin() + 1, c.back());
+    int expected[] = {2, 3, 0, 1, 2, 3};
+    for (size_t i = 0; i != 6; ++i) EXPECT_EQ(expected[i], c[i]);
+
+    container_reloc d;
+    for (int i = 0; i != 4; ++i) d.push_back(i);
+    d.reserve(10);
+    d.insert(std::as_const(d).begin(), d[2]);
+    d.insert(std::as_const(d).begin() + 1, d.back());
+    for (size_t i = 0; i != 6; ++i) EXPECT_EQ(expected[i], d[i]);
+  });
+}
+
+TEST(correctness, insert_shared_single_allocation) {
+  counting_resource r;
+  vector<int, 2, doubling_growth, std::pmr::polymorphic_allocator<int>> c(&r);
+  for (int i = 0; i != 8; ++i) c.push_back(i);
+  auto d = c;
+  size_t before = r.allocated;
+  c.insert(std::as_const(c).begin() + 3, 42);
+  EXPECT_EQ(before + 1, r.allocated);
+  EXPECT_EQ(9u, c.size());
+  EXPECT_EQ(42, c[3]);
+  EXPECT_EQ(3, c[4]);
+  EXPECT_EQ(3, d[3]);
+  c.insert(std::as_const(c).begin(), -1);
+  EXPECT_EQ(before + 1, r.allocated);
+  EXPECT_EQ(-1, c[0]);
+  EXPECT_EQ(7, c.back());
+}
+
+TEST(correctness, insert_range_relocatable) {
+  faulty_run([] {
+    container_reloc c;
+    for (int i = 0; i != 10; ++i) c.push_back(i);
+    container_reloc d = c;
+    std::vector<int> src(5, -1);
+    c.insert(std::as_const(c).begin() + 3, src.begin(), src.end());
+    c.reserve(100);
+    c.insert(std::as_const(c).begin(), src.begin(), src.end());
+    ASSERT_EQ(20u, c.size());
+    EXPECT_EQ(-1, c[4]);
+    EXPECT_EQ(0, c[5]);
+    EXPECT_EQ(-1, c[8]);
+    EXPECT_EQ(3, c[13]);
+    EXPECT_EQ(9, c[19]);
+    EXPECT_EQ(9, d[9]);
+  });
+}
+
+TEST(correctness, append_range_single_allocation) {
+  counting_resource r;
+  vector<int, 2, doubling_growth, std::pmr::polymorphic_allocator<int>> c(&r);
+  c.push_back(-1);
+  std::vector<int> src(10000);
+  for (int i = 0; i != 10000; ++i) src[i] = i;
+  c.append_range(src);
+  EXPECT_EQ(1u, r.allocated);
+  ASSERT_EQ(10001u, c.size());
+  EXPECT_EQ(-1, c[0]);
+  for (int i = 0; i != 10000; ++i) ASSERT_EQ(i, c[i + 1]);
+  c.append_range(std::vector<int>());
+  EXPECT_EQ(1u, r.allocated);
+}
+
+TEST(correctness, deferred_destruction) {
+  deferred_destruction::enable(1024);
+  {
+    vector<tracked> big;
+    for (int i = 0; i != 1000; ++i) big.push_back(i);
+    vector<tracked> copy = big;
+    vector<tracked> small;
+    for (int i = 0; i != 10; ++i) small.push_back(i);
+    // Growing left old buffers behind.
+    deferred_destruction::drain();
+    EXPECT_EQ(1010u, tracked_alive);
+    small = vector<tracked>();
+    EXPECT_EQ(1000u, tracked_alive);
+    big = vector<tracked>();
+    EXPECT_EQ(1000u, tracked_alive);
+  }
+  deferred_destruction::drain();
+  EXPECT_EQ(0u, tracked_alive);
+
+  for (int k = 0; k != 20; ++k) {
+    vector<tracked> v;
+    for (int i = 0; i != 500; ++i) v.push_back(i);
+  }
+  deferred_destruction::disable();
+  EXPECT_EQ(0u, tracked_alive);
+
+  {
+    vector<tracked> big;
+    for (int i = 0; i != 1000; ++i) big.push_back(i);
+  }
+  EXPECT_EQ(0u, tracked_alive);
+}
+
+TEST(correctness, slice) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container::slice_type s;
+    {
+      container c;
+      for (int i = 0; i != 10; ++i) c.push_back(i);
+      container const& cc = c;
+      s = cc.slice(cc.begin() + 2, cc.begin() + 7);
+      EXPECT_EQ(cc.data() + 2, std::as_const(s).data());
+      EXPECT_EQ(5u, s.size());
+      EXPECT_EQ(2, s.front());
+      EXPECT_EQ(6, s.back());
+
+      container::slice_type const& cs = s;
+      container::slice_type t = cs.slice(cs.begin() + 1, cs.end());
+      EXPECT_EQ(cc.data() + 3, std::as_const(t).data());
+      t[0] = 42;
+      EXPECT_NE(cc.data() + 3, std::as_const(t).data());
+      EXPECT_EQ(3, cc[3]);
+      EXPECT_EQ(3, s[1]);
+      EXPECT_EQ(42, t[0]);
+
+      c[2] = -2;
+      EXPECT_EQ(2, std::as_const(s)[0]);
+    }
+    // Sole owner now: writes go straight to the buffer.
+    counted const* p = std::as_const(s).data();
+    s[0] = 7;
+    EXPECT_EQ(p, std::as_const(s).data());
+    EXPECT_EQ(7, s[0]);
+    EXPECT_EQ(6, s[4]);
+  });
+}
+
+TEST(correctness, slice_inline) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container_small c;
+    c.push_back(1);
+    c.push_back(2);
+    container_small const& cc = c;
+    container_small::slice_type s = cc.slice(cc.begin() + 1, cc.end());
+    c[1] = 5;
+    EXPECT_EQ(1u, s.size());
+    EXPECT_EQ(2, s[0]);
+    EXPECT_TRUE(cc.slice(cc.begin(), cc.begin()).empty());
+  });
+}
+
+TEST(correctness, slice_across_threads) {
+  container_int c;
+  for (int i = 0; i != 4000; ++i) c.push_back(i);
+  container_int const& cc = c;
+  std::vector<std::thread> threads;
+  for (int t = 0; t != 4; ++t) {
+    auto s = cc.slice(cc.begin() + t * 1000, cc.begin() + (t + 1) * 1000);
+    threads.emplace_back([s, t]() mutable {
+      long sum = 0;
+      for (int v : std::as_const(s)) sum += v;
+      EXPECT_EQ(1000L * t * 1000 + 999 * 1000 / 2, sum);
+      s[0] = -1;
+      EXPECT_EQ(-1, s[0]);
+    });
+  }
+  for (auto& t : threads) t.join();
+  EXPECT_EQ(0, cc[0]);
+  EXPECT_EQ(1000, cc[1000]);
+}
+
+TEST(correctness, resize_within_capacity) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    c.reserve(10);
+    counted const* p = std::as_const(c).data();
+    c.resize(8, 1);
+    c.resize(3, 2);
+    c.resize(10, 3);
+    EXPECT_EQ(p, std::as_const(c).data());
+    EXPECT_EQ(1, c[2]);
+    EXPECT_EQ(3, c[3]);
+    EXPECT_EQ(3, c[9]);
+  });
+}
+
+TEST(correctness, resize_from_own_element) {
+  vector<int, 2, small_mmap_growth> c;
+  for (int i = 0; i != 5000; ++i) c.push_back(i + 1);
+  size_t n = c.capacity() * 4;
+  c.resize(n, std::as_const(c)[0]);
+  ASSERT_EQ(n, c.size());
+  EXPECT_EQ(1, std::as_const(c)[4999 + 1]);
+  EXPECT_EQ(1, std::as_const(c)[n - 1]);
+}
+
+TEST(correctness, resize_for_overwrite) {
+  faulty_run([] {
+    container_int c;
+    c.reserve(100);
+    c.push_back(42);
+    int const* p = std::as_const(c).data();
+    c.resize_for_overwrite(100);
+    EXPECT_EQ(p, std::as_const(c).data());
+    EXPECT_EQ(100u, c.size());
+    EXPECT_EQ(42, c[0]);
+    for (int i = 0; i != 100; ++i) c[i] = i;
+
+    container_int d = c;
+    d.resize_for_overwrite(200);
+    EXPECT_EQ(100u, c.size());
+    EXPECT_EQ(99, d[99]);
+    d.resize_for_overwrite(1);
+    EXPECT_EQ(0, d[0]);
+    EXPECT_EQ(99, c[99]);
+  });
+}
+
+TEST(correctness, parallel_copy) {
+  vector<std::string, 1, parallel_copy_growth> c;
+  for (int i = 0; i != 100000; ++i) c.push_back(std::to_string(i));
+  auto d = c;
+  d[0] = "x";
+  EXPECT_EQ("0", c[0]);
+  EXPECT_EQ("x", d[0]);
+  for (int i = 1; i != 100000; ++i) ASSERT_EQ(std::to_string(i), d[i]);
+
+  vector<int, 1, parallel_copy_growth> e;
+  for (int i = 0; i != 100000; ++i) e.push_back(i);
+  auto f = e;
+  f.unshare();
+  for (int i = 0; i != 100000; ++i) ASSERT_EQ(i, f[i]);
+}
+
+TEST(correctness, parallel_copy_throw) {
+  {
+    vector<tracked, 1, parallel_copy_growth> c;
+    for (int i = 0; i != 10000; ++i) c.push_back(i);
+    c.shrink_to_fit();
+    size_t alive = tracked_alive;
+    auto d = c;
+    tracked_throw_on = 9000;
+    EXPECT_THROW(d.unshare(), std::runtime_error);
+    tracked_throw_on = -1;
+    EXPECT_EQ(alive, tracked_alive);
+    EXPECT_EQ(std::as_const(c).data(), std::as_const(d).data());
+  }
+  EXPECT_EQ(0u, tracked_alive);
+}
+
+TEST(correctness, save_load) {
+  std::string path = "/tmp/vector_testing_" + std::to_string(getpid());
+  {
+    container_int c;
+    for (int i = 0; i != 10000; ++i) c.push_back(i * 3);
+    c.save(path.c_str());
+  }
+  {
+    container_int c = container_int::load(path.c_str());
+    container_int const& cc = c;
+    ASSERT_EQ(10000u, cc.size());
+    for (int i = 0; i != 10000; ++i) ASSERT_EQ(i * 3, cc[i]);
+    container_int d = c;
+    EXPECT_EQ(cc.data(), std::as_const(d).data());
+
+    int const* mapped = cc.data();
+    d.push_back(1);
+    c[0] = -1;
+    EXPECT_NE(mapped, cc.data());
+    EXPECT_EQ(-1, cc[0]);
+    EXPECT_EQ(0, d[0]);
+    EXPECT_EQ(1, d.back());
+  }
+  {
+    container_int c = container_int::load(path.c_str());
+    EXPECT_EQ(0, std::as_const(c)[0]);
+    EXPECT_THROW(vector<long>::load(path.c_str()), std::runtime_error);
+  }
+  {
+    FILE* f = std::fopen(path.c_str(), "ab");
+    ASSERT_TRUE(f);
+    std::fputc(0, f);
+    std::fclose(f);
+    EXPECT_THROW(container_int::load(path.c_str()), std::runtime_error);
+  }
+  container_int().save(path.c_str());
+  EXPECT_TRUE(container_int::load(path.c_str()).empty());
+  std::remove(path.c_str());
+  EXPECT_THROW(container_int::load(path.c_str()), std::system_error);
+}
+
+TEST(correctness, aligned_buffers) {
+  auto aligned = [](void const* p) {
+    return reinterpret_cast<uintptr_t>(p) % 64 == 0;
+  };
+  vector<char, 8, cache_aligned_growth> c;
+  for (int i = 0; i != 1000; ++i) {
+    c.push_back(char(i));
+    if (c.size() > 8) {
+      ASSERT_TRUE(aligned(std::as_const(c).data()));
+    }
+  }
+  vector<char, 8, cache_aligned_growth> d = c;
+  d[0] = 1;
+  EXPECT_TRUE(aligned(std::as_const(d).data()));
+  d.reserve(5000);
+  EXPECT_TRUE(aligned(std::as_const(d).data()));
+  d.shrink_to_fit();
+  EXPECT_TRUE(aligned(std::as_const(d).data()));
+
+  counting_resource r;
+  vector<double, 1, cache_aligned_growth,
+         std::pmr::polymorphic_allocator<double>>
+      p(&r);
+  p.resize(100, 1.5);
+  EXPECT_TRUE(aligned(std::as_const(p).data()));
+
+  vector<int, 1, page_aligned_growth> m(10000, 7);
+  EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(std::as_const(m).data()) % 4096);
+  m.push_back(8);
+  EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(std::as_const(m).data()) % 4096);
+}
+
+TEST(correctness, aligned_save_load) {
+  typedef vector<int, 1, cache_aligned_growth> aligned_int;
+  std::string path = "/tmp/vector_testing_aligned_" + std::to_string(getpid());
+  aligned_int(1000, 5).save(path.c_str());
+  aligned_int c = aligned_int::load(path.c_str());
+  EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(std::as_const(c).data()) % 64);
+  EXPECT_EQ(1000u, c.size());
+  EXPECT_EQ(5, std::as_const(c)[999]);
+  EXPECT_THROW(container_int::load(path.c_str()), std::runtime_error);
+  std::remove(path.c_str());
+}
+
+TEST(correctness, bool_packed) {
+  vector<bool> c;
+  std::vector<bool> expected;
+  for (int i = 0; i != 1000; ++i) {
+    bool v = i % 3 == 0 || i % 7 == 0;
+    c.push_back(v);
+    expected.push_back(v);
+  }
+  EXPECT_EQ(1000u, c.size());
+  EXPECT_GE(c.capacity(), 1000u);
+  EXPECT_LT(c.capacity(), 2048u);
+  for (size_t i = 0; i != expected.size(); ++i) ASSERT_EQ(expected[i], c[i]);
+  EXPECT_TRUE(std::equal(expected.begin(), expected.end(),
+                         std::as_const(c).begin(), std::as_const(c).end()));
+  EXPECT_EQ(size_t(std::count(expected.begin(), expected.end(), true)),
+            c.count());
+
+  while (c.size() > 70) {
+    c.pop_back();
+    expected.pop_back();
+  }
+  EXPECT_TRUE(std::equal(expected.rbegin(), expected.rend(),
+                         std::as_const(c).rbegin(), std::as_const(c).rend()));
+}
+
+TEST(correctness, bool_inline) {
+  vector<bool, 128> c(100, true);
+  EXPECT_EQ(128u, c.capacity());
+  EXPECT_EQ(100u, c.count());
+  c.resize(130, false);
+  EXPECT_EQ(100u, c.count());
+  EXPECT_FALSE(c.back());
+  c.resize(64);
+  EXPECT_EQ(64u, c.count());
+  c.resize(65, true);
+  EXPECT_EQ(65u, c.count());
+}
+
+TEST(correctness, bool_copy_on_write) {
+  vector<bool> a(300, false);
+  vector<bool> b = a;
+  EXPECT_EQ(std::as_const(a).begin().words, std::as_const(b).begin().words);
+  b[200] = true;
+  EXPECT_FALSE(a[200]);
+  EXPECT_TRUE(b[200]);
+  EXPECT_NE(std::as_const(a).begin().words, std::as_const(b).begin().words);
+
+  vector<bool> d = b;
+  for (auto r : d) r.flip();
+  EXPECT_EQ(1u, b.count());
+  EXPECT_EQ(299u, d.count());
+  swap(d[0], d[200]);
+  EXPECT_FALSE(d[0]);
+  EXPECT_TRUE(d[200]);
+
+  vector<bool> e = d;
+  vector<bool>::span s = e.mutable_span();
+  EXPECT_EQ(300u, s.size());
+  s[0] = true;
+  EXPECT_TRUE(std::as_const(e)[0]);
+  EXPECT_FALSE(std::as_const(d)[0]);
+}
+
+TEST(correctness, bool_pop_back_shared) {
+  vector<bool> a(100, false);
+  a[98] = true;
+  vector<bool> b = a;
+  b.pop_back();
+  EXPECT_EQ(std::as_const(a).begin().words, std::as_const(b).begin().words);
+  b.pop_back();
+  EXPECT_NE(std::as_const(a).begin().words, std::as_const(b).begin().words);
+  EXPECT_EQ(1u, a.count());
+  EXPECT_EQ(0u, b.count());
+  vector<bool> c;
+  c.pop_back();
+  EXPECT_TRUE(c.empty());
+}
+
+TEST(correctness, bool_find_first) {
+  vector<bool> c(1000, false);
+  EXPECT_EQ(1000u, c.find_first());
+  c[3] = true;
+  c[64] = true;
+  c[700] = true;
+  EXPECT_EQ(3u, c.find_first());
+  EXPECT_EQ(3u, c.find_first(3));
+  EXPECT_EQ(64u, c.find_first(4));
+  EXPECT_EQ(700u, c.find_first(65));
+  EXPECT_EQ(1000u, c.find_first(701));
+  EXPECT_EQ(1000u, c.find_first(5000));
+  size_t n = 0;
+  for (size_t i = c.find_first(); i != c.size(); i = c.find_first(i + 1))
+    ++n;
+  EXPECT_EQ(3u, n);
+}
+
+TEST(correctness, bool_bitwise) {
+  vector<bool> a, b;
+  for (int i = 0; i != 200; ++i) {
+    a.push_back(i % 2 == 0);
+    b.push_back(i % 3 == 0);
+  }
+  vector<bool> x = a & b, y = a | b, z = a ^ b, n = ~a;
+  for (int i = 0; i != 200; ++i) {
+    ASSERT_EQ(i % 6 == 0, x[i]);
+    ASSERT_EQ(i % 2 == 0 || i % 3 == 0, y[i]);
+    ASSERT_EQ((i % 2 == 0) != (i % 3 == 0), z[i]);
+    ASSERT_EQ(i % 2 != 0, n[i]);
+  }
+  EXPECT_EQ(100u, n.count());
+  EXPECT_EQ(100u, a.count());
+  a &= a;
+  EXPECT_EQ(100u, a.count());
+  EXPECT_EQ(200u, (a | n).count());
+}
+
+TEST(correctness, bool_compare) {
+  vector<bool> a(100, false), b(100, false);
+  EXPECT_EQ(a, b);
+  b[90] = true;
+  EXPECT_NE(a, b);
+  EXPECT_LT(a, b);
+  a[10] = true;
+  EXPECT_LT(b, a);
+  b.resize(10);
+  EXPECT_LT(b, a);
+  a.resize(10);
+  EXPECT_EQ(a, b);
+  a.push_back(false);
+  EXPECT_LT(b, a);
+}
+
 TEST(correctness, subscript) {
   faulty_run([] {
     counted::no_new_instances_guard g;
@@ -370,6 +1563,53 @@ TEST(correctness, erase_range_all) {
   });
 }
 
+TEST(correctness, erase_range_keep_last) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    c.push_back(4);
+    c.push_back(8);
+    c.push_back(15);
+
+    c.erase(c.begin(), c.end() - 1);
+    EXPECT_EQ(1u, c.size());
+    EXPECT_EQ(15, c[0]);
+  });
+}
+
+TEST(correctness, erase_in_place) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    for (size_t i = 0; i != 10; ++i) c.push_back(i);
+    counted const* p = c.data();
+    c.erase(c.begin() + 2, c.begin() + 4);
+    c.erase(c.end() - 1);
+    EXPECT_EQ(p, c.data());
+    EXPECT_EQ(7u, c.size());
+    EXPECT_EQ(1, c[1]);
+    EXPECT_EQ(4, c[2]);
+    EXPECT_EQ(8, c[6]);
+  });
+}
+
+TEST(correctness, erase_shared) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    for (size_t i = 0; i != 6; ++i) c.push_back(i);
+    container d = c;
+    container const& cd = d;
+    d.erase(cd.begin() + 1, cd.begin() + 3);
+    EXPECT_EQ(6u, c.size());
+    EXPECT_EQ(4u, d.size());
+    EXPECT_EQ(1, c[1]);
+    EXPECT_EQ(0, d[0]);
+    EXPECT_EQ(3, d[1]);
+    EXPECT_EQ(5, d[3]);
+  });
+}
+
 TEST(correctness, reserve) {
   faulty_run([] {
     counted::no_new_instances_guard g;
@@ -412,6 +1652,16 @@ TEST(correctness, reserve_2) {
   });
 }
 
+TEST(correctness, reserve_empty) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    c.reserve(10);
+    EXPECT_TRUE(c.empty());
+    EXPECT_EQ(0u, c.size());
+  });
+}
+
 TEST(correctness, front_back) {
   faulty_run([] {
     counted::no_new_instances_guard g;
@@ -775,6 +2025,54 @@ TEST(correctness, comparison_long) {
   });
 }
 
+TEST(correctness, comparison_shared) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    for (size_t i = 0; i != 5; ++i) c.push_back(i);
+    container d = c;
+    EXPECT_TRUE(c == d);
+    EXPECT_FALSE(c < d);
+    EXPECT_TRUE(c <= d);
+    d[4] = 5;
+    EXPECT_FALSE(c == d);
+    EXPECT_TRUE(c < d);
+  });
+}
+
+TEST(correctness, comparison_shared_nan) {
+  faulty_run([] {
+    vector<double> c;
+    c.push_back(1);
+    c.push_back(NAN);
+    c.push_back(2);
+    vector<double> d = c;
+    EXPECT_FALSE(c == d);
+    EXPECT_FALSE(c < d);
+    EXPECT_FALSE(d < c);
+  });
+}
+
+TEST(correctness, comparison_int_long) {
+  faulty_run([] {
+    container_int c, d;
+    for (int i = 0; i != 1000; ++i) {
+      c.push_back(i);
+      d.push_back(i);
+    }
+    EXPECT_TRUE(c == d);
+    EXPECT_FALSE(c < d);
+    d[700] = -1;
+    EXPECT_FALSE(c == d);
+    EXPECT_TRUE(d < c);
+    EXPECT_FALSE(c < d);
+    d[700] = 700;
+    d.push_back(0);
+    EXPECT_TRUE(c < d);
+    EXPECT_FALSE(c == d);
+  });
+}
+
 TEST(correctness, swap_empty_self) {
   faulty_run([] {
     counted::no_new_instances_guard g;
@@ -893,6 +2191,56 @@ TEST(exceptions, nothrow_subscript) {
   });
 }
 
+TEST(exceptions, insert_count_in_place) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    c.reserve(20);
+    for (int i = 0; i != 5; ++i) c.push_back(i);
+    counted v(7);
+    c.insert(std::as_const(c).begin() + 2, 3, v);
+    container const& cc = c;
+    ASSERT_EQ(8u, cc.size());
+    EXPECT_EQ(7, cc[4]);
+    EXPECT_EQ(2, cc[5]);
+  });
+}
+
+TEST(exceptions, insert_single_in_place) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    c.reserve(20);
+    for (int i = 0; i != 5; ++i) c.push_back(i);
+    c.insert(std::as_const(c).begin() + 2, 7);
+    c.emplace(std::as_const(c).begin() + 1, 8);
+    container const& cc = c;
+    ASSERT_EQ(7u, cc.size());
+    EXPECT_EQ(8, cc[1]);
+    EXPECT_EQ(7, cc[3]);
+    EXPECT_EQ(4, cc[6]);
+  });
+}
+
+TEST(exceptions, insert_range_in_place) {
+  faulty_run([] {
+    counted::no_new_instances_guard g;
+    container c;
+    c.reserve(20);
+    for (int i = 0; i != 5; ++i) c.push_back(i);
+    container r;
+    for (int i = 10; i != 13; ++i) r.push_back(i);
+    c.insert(std::as_const(c).begin() + 1, std::as_const(r).begin(),
+             std::as_const(r).end());
+    c.append_range(std::as_const(r));
+    container const& cc = c;
+    ASSERT_EQ(11u, cc.size());
+    EXPECT_EQ(12, cc[3]);
+    EXPECT_EQ(1, cc[4]);
+    EXPECT_EQ(12, cc[10]);
+  });
+}
+
 TEST(exceptions, reserve) {
   faulty_run([] {
     counted::no_new_instances_guard g;